@@ -1,201 +1,3491 @@
 #include <bits/stdc++.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <malloc.h>
+#include <fnmatch.h>
+#include <linux/io_uring.h>
+#undef BLOCK_SIZE       // pulled in from <linux/fs.h>, we define our own
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 using namespace std;
 
+// Approximate heap footprint of standard containers (libstdc++ layout)
+static size_t stringHeapBytes(const string &s) {
+    return s.capacity() > 15 ? s.capacity() + 1 : 0;    // short strings live inline
+}
+
+template<typename M>
+static size_t hashTableBytes(const M &m, size_t nodeExtra = 0) {
+    return m.bucket_count() * sizeof(void*) + m.size() * (sizeof(void*) + sizeof(typename M::value_type) + nodeExtra);
+}
+
+// ---------------- NAME TABLE ----------------
+// Every distinct file/directory name in a filesystem is stored once and
+// referenced by a small integer id, so nodes and directory entries compare
+// names as integers.
+// Each directory entry holds a reference on its name; an id whose last entry
+// goes away is freed and reused, so churning unique names does not grow the table.
+// Each FileSystem owns its table and only touches it under its own lock, so
+// shards never contend on names.
+class NameTable {
+private:
+    unordered_map<string, int> ids;
+    deque<string> names;        // id -> name; deque keeps references stable
+    vector<int> refs;           // id -> directory entries using it
+    vector<int> freeIds;
+
+public:
+    // Id for `name`, taking a reference on it
+    int intern(const string &name) {
+        auto it = ids.find(name);
+        if(it != ids.end()) {
+            refs[it->second]++;
+            return it->second;
+        }
+        int id;
+        if(!freeIds.empty()) {
+            id = freeIds.back();
+            freeIds.pop_back();
+            names[id] = name;
+            refs[id] = 1;
+        } else {
+            id = names.size();
+            names.push_back(name);
+            refs.push_back(1);
+        }
+        ids[name] = id;
+        return id;
+    }
+
+    void release(int id) {
+        if(--refs[id] > 0) return;
+        ids.erase(names[id]);
+        names[id].clear();
+        names[id].shrink_to_fit();
+        freeIds.push_back(id);
+    }
+
+    // Id of an already interned name, -1 if the name was never seen
+    int lookup(const string &name) {
+        auto it = ids.find(name);
+        return it == ids.end() ? -1 : it->second;
+    }
+
+    const string& get(int id) {
+        return names[id];
+    }
+
+    // Live names
+    size_t size() {
+        return names.size() - freeIds.size();
+    }
+
+    size_t memoryUsage() {
+        size_t bytes = hashTableBytes(ids, sizeof(size_t)) + names.size() * sizeof(string)
+                     + refs.capacity() * sizeof(int) + freeIds.capacity() * sizeof(int);
+        for(auto &name : names) bytes += 2 * stringHeapBytes(name);    // deque copy and map key
+        return bytes;
+    }
+
+    // Resize the name index to the live names
+    void compact() {
+        unordered_map<string, int> fresh(ids.begin(), ids.end());
+        ids.swap(fresh);
+    }
+};
+
+static int64_t nowNs() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+class Directory;
+
 class Node {
 public:
-    string name;
+    int nameId;             // name of the entry in `parent`, -1 while detached
     bool isFile;
+    Directory* parent;
+    int64_t createdNs;
+    int64_t modifiedNs;     // content for files, entries for directories
+
+    Node(bool isFile) {
+        this->nameId = -1;
+        this->isFile = isFile;
+        this->parent = nullptr;
+        this->createdNs = this->modifiedNs = nowNs();
+    }
+
+    virtual ~Node() {}
+};
+
+// ---------------- ASYNC DISK I/O ----------------
+// Minimal io_uring front end for disk-backed tiers. Requests are queued with
+// write/read/fsync and handed to the kernel together by submit(); a poller
+// thread reaps completions and fulfils each request's future, or runs its
+// callback, with the syscall result (bytes transferred or -errno). Callbacks
+// run with the ring locked and must not call back into AsyncIO. Buffers must
+// stay alive until the request completes. Without io_uring, requests run
+// synchronously.
+class AsyncIO {
+private:
+    int ringFd;
+    unsigned entries;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    io_uring_sqe* sqes;
+    io_uring_cqe* cqes;
+    void* sqRing;
+    void* cqRing;
+    size_t sqRingSize, cqRingSize;
+
+    mutex mtx;
+    condition_variable slotFree;
+    unsigned queued;                                // in the SQ, not yet submitted
+    uint64_t nextTag;
+    unordered_map<uint64_t, function<void(int)>> inflight;
+    bool stopping;
+    thread poller;
+
+    int enter(unsigned toSubmit, unsigned minComplete, unsigned flags) {
+        return syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, nullptr, 0);
+    }
+
+    // Hand the queued requests to the kernel. A busy ring is retried once the
+    // poller has reaped some completions; any other error fails the requests
+    // the kernel did not take, so no caller waits on them forever.
+    void submitLocked(unique_lock<mutex> &lock) {
+        while(queued > 0) {
+            int res = enter(queued, 0, 0);
+            if(res > 0) {
+                queued -= min((unsigned)res, queued);
+                continue;
+            }
+            int err = res == 0 ? EAGAIN : errno;
+            if(err == EINTR) continue;
+            if(err == EAGAIN || err == EBUSY) {
+                lock.unlock();
+                this_thread::yield();
+                lock.lock();
+                continue;
+            }
+
+            unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+            unsigned tail = *sqTail;
+            for(unsigned i = head; i != tail; i++) {
+                auto it = inflight.find(sqes[sqArray[i & *sqMask]].user_data);
+                if(it == inflight.end()) continue;
+                it->second(-err);
+                inflight.erase(it);
+            }
+            __atomic_store_n(sqTail, head, __ATOMIC_RELEASE);
+            queued = 0;
+            slotFree.notify_all();
+        }
+    }
+
+    // Queue one request; called with mtx held
+    void queue(uint8_t opcode, int fd, const void* buf, size_t len, off_t off,
+               function<void(int)> done, unique_lock<mutex> &lock) {
+        if(ringFd < 0) {
+            int res;
+            if(opcode == IORING_OP_WRITE) res = pwrite(fd, buf, len, off);
+            else if(opcode == IORING_OP_READ) res = pread(fd, (void*)buf, len, off);
+            else res = ::fsync(fd);
+            done(res < 0 ? -errno : res);
+            return;
+        }
+
+        // Never have more requests in flight than the completion queue can hold
+        while(true) {
+            if(inflight.size() >= entries) {
+                submitLocked(lock);
+                if(inflight.size() >= entries) slotFree.wait(lock);
+            } else if(*sqTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) == entries) {
+                submitLocked(lock);
+            } else {
+                break;
+            }
+        }
+
+        unsigned tail = *sqTail;
+        unsigned idx = tail & *sqMask;
+        io_uring_sqe* sqe = &sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = opcode;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)buf;
+        sqe->len = len;
+        sqe->off = off;
+        sqe->user_data = nextTag;
+        sqArray[idx] = idx;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        queued++;
+
+        inflight[nextTag++] = move(done);
+    }
+
+    future<int> queue(uint8_t opcode, int fd, const void* buf, size_t len, off_t off, unique_lock<mutex> &lock) {
+        auto done = make_shared<promise<int>>();
+        queue(opcode, fd, buf, len, off, [done](int res) { done->set_value(res); }, lock);
+        return done->get_future();
+    }
+
+    void pollCompletions() {
+        while(true) {
+            enter(0, 1, IORING_ENTER_GETEVENTS);
+
+            lock_guard<mutex> lock(mtx);
+            unsigned head = *cqHead;
+            unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            for(; head != tail; head++) {
+                io_uring_cqe* cqe = &cqes[head & *cqMask];
+                auto it = inflight.find(cqe->user_data);
+                if(it != inflight.end()) {
+                    it->second(cqe->res);
+                    inflight.erase(it);
+                }
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+            slotFree.notify_all();
+
+            if(stopping && inflight.empty()) return;
+        }
+    }
+
+public:
+    AsyncIO(unsigned entries = 256) {
+        queued = 0;
+        nextTag = 1;            // tag 0 wakes the poller on shutdown
+        stopping = false;
+
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        ringFd = syscall(__NR_io_uring_setup, entries, &params);
+        if(ringFd < 0) return;
+        this->entries = params.sq_entries;
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if(single) sqRingSize = cqRingSize = max(sqRingSize, cqRingSize);
+
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        cqRing = single ? sqRing
+                        : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        sqes = (io_uring_sqe*)mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+        if(sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+            close(ringFd);
+            ringFd = -1;
+            return;
+        }
+
+        char* sq = (char*)sqRing;
+        sqHead = (unsigned*)(sq + params.sq_off.head);
+        sqTail = (unsigned*)(sq + params.sq_off.tail);
+        sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+        sqArray = (unsigned*)(sq + params.sq_off.array);
+
+        char* cq = (char*)cqRing;
+        cqHead = (unsigned*)(cq + params.cq_off.head);
+        cqTail = (unsigned*)(cq + params.cq_off.tail);
+        cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+        poller = thread(&AsyncIO::pollCompletions, this);
+    }
+
+    ~AsyncIO() {
+        if(ringFd < 0) return;
+        {
+            unique_lock<mutex> lock(mtx);
+            stopping = true;
+            submitLocked(lock);
+
+            // A no-op with tag 0 wakes the poller even when nothing is in flight
+            unsigned tail = *sqTail;
+            unsigned idx = tail & *sqMask;
+            memset(&sqes[idx], 0, sizeof(io_uring_sqe));
+            sqes[idx].opcode = IORING_OP_NOP;
+            sqArray[idx] = idx;
+            __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+            queued++;
+            submitLocked(lock);
+        }
+        poller.join();
+
+        munmap(sqes, entries * sizeof(io_uring_sqe));
+        if(cqRing != sqRing) munmap(cqRing, cqRingSize);
+        munmap(sqRing, sqRingSize);
+        close(ringFd);
+    }
+
+    bool usingIoUring() {
+        return ringFd >= 0;
+    }
+
+    future<int> write(int fd, const void* buf, size_t len, off_t off) {
+        unique_lock<mutex> lock(mtx);
+        return queue(IORING_OP_WRITE, fd, buf, len, off, lock);
+    }
+
+    future<int> read(int fd, void* buf, size_t len, off_t off) {
+        unique_lock<mutex> lock(mtx);
+        return queue(IORING_OP_READ, fd, buf, len, off, lock);
+    }
+
+    future<int> fsync(int fd) {
+        unique_lock<mutex> lock(mtx);
+        return queue(IORING_OP_FSYNC, fd, nullptr, 0, 0, lock);
+    }
+
+    // Like write(), but runs `done` on completion instead of returning a future
+    void write(int fd, const void* buf, size_t len, off_t off, function<void(int)> done) {
+        unique_lock<mutex> lock(mtx);
+        queue(IORING_OP_WRITE, fd, buf, len, off, move(done), lock);
+    }
+
+    // Hand every queued request to the kernel with a single syscall
+    void submit() {
+        unique_lock<mutex> lock(mtx);
+        submitLocked(lock);
+    }
+};
+
+// ---------------- CRC32C ----------------
+// Castagnoli CRC, using the SSE4.2 crc32 instruction when the CPU has it
+// (checked once at runtime) and a byte-wise table otherwise.
+class Crc32c {
+private:
+    uint32_t table[256];
+    bool hardware;
+
+    Crc32c() {
+        for(uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for(int k = 0; k < 8; k++) c = (c >> 1) ^ (0x82F63B78 & (0 - (c & 1)));
+            table[i] = c;
+        }
+#if defined(__x86_64__)
+        hardware = __builtin_cpu_supports("sse4.2");
+#else
+        hardware = false;
+#endif
+    }
+
+#if defined(__x86_64__)
+    __attribute__((target("sse4.2")))
+    static uint32_t hardwareCrc(uint32_t crc, const char* p, size_t n) {
+        uint64_t c = crc;
+        for(; n >= 8; n -= 8, p += 8) {
+            uint64_t v;
+            memcpy(&v, p, 8);
+            c = __builtin_ia32_crc32di(c, v);
+        }
+        uint32_t c32 = c;
+        for(; n > 0; n--, p++) c32 = __builtin_ia32_crc32qi(c32, *p);
+        return c32;
+    }
+#endif
+
+    uint32_t tableCrc(uint32_t crc, const char* p, size_t n) {
+        for(size_t i = 0; i < n; i++) crc = table[(crc ^ (unsigned char)p[i]) & 0xFF] ^ (crc >> 8);
+        return crc;
+    }
+
+public:
+    static Crc32c& instance() {
+        static Crc32c crc;
+        return crc;
+    }
+
+    uint32_t compute(const char* p, size_t n) {
+#if defined(__x86_64__)
+        if(hardware) return ~hardwareCrc(~0u, p, n);
+#endif
+        return ~tableCrc(~0u, p, n);
+    }
+
+    uint32_t computeSoftware(const char* p, size_t n) {
+        return ~tableCrc(~0u, p, n);
+    }
+};
+
+// ---------------- BLOCK STORE ----------------
+// File contents are split into fixed-size blocks. Identical blocks are stored
+// once and shared by reference count across all files.
+//
+// With a memory budget set, the least recently read blocks are written to a
+// spill file and dropped from memory; get() pages them back in on demand.
+// Blocks never change once written, so a spilled copy stays valid and a block
+// is written to disk at most once. The spill file is divided into
+// BLOCK_SIZE slots; a freed block's slot is reused by the next spill.
+// Spill writes complete in the background: a block stays resident until its
+// write has landed and is only evicted by a later pass.
+const size_t BLOCK_SIZE = 4096;
+
+struct Block {
+    string data;            // empty while spilled
+    uint64_t hash;
+    uint32_t crc;           // CRC32C of the content, set once on creation
+    int refCount;
+    size_t length;
+    long long spillOffset;  // spill slot, -1 until written to the spill file
+    bool resident;
+    bool writing;           // spill write still in flight
+    list<int>::iterator lruPos;
+};
+
+struct TierStats {
+    size_t residentBytes;
+    size_t spilledBytes;    // unique bytes currently only on disk
+    size_t pageIns;
+    size_t pageOuts;
+    size_t spillFileBytes;  // size of the spill file, including free slots
+};
+
+struct DedupStats {
+    size_t logicalBytes;    // bytes as seen by readers
+    size_t storedBytes;     // bytes actually held by unique blocks
+    size_t uniqueBlocks;
+    double ratio;           // logicalBytes / storedBytes
+};
+
+class BlockStore {
+private:
+    vector<Block> blocks;                       // block id -> block
+    vector<int> freeIds;                        // recycled ids
+    unordered_multimap<uint64_t, int> index;    // hash -> candidate block ids
+    size_t logicalBytes = 0;
+    size_t storedBytes = 0;
+
+    list<int> lru;                  // resident block ids, most recently read first
+    size_t memoryBudget = 0;        // 0 = keep everything in memory
+    size_t residentBytes = 0;
+    int spillFd = -1;
+    long long spillEnd = 0;
+    vector<long long> freeSlots;    // spill slots of released blocks
+    unordered_map<long long, int> writes;   // slot -> block id of in-flight spill writes, -1 once released
+    mutex doneMtx;
+    condition_variable doneCv;
+    vector<pair<long long, int>> done;      // (slot, result) of completed writes, filled by the I/O thread
+    size_t pageIns = 0;
+    size_t pageOuts = 0;
+    unique_ptr<AsyncIO> io;
+    bool verifyOnRead = false;
+    atomic<size_t> checksumFailures{0};
+
+    bool openSpill() {
+        if(spillFd >= 0) return true;
+        FILE* f = tmpfile();
+        if(f == nullptr) return false;
+        spillFd = dup(fileno(f));
+        fclose(f);
+        io.reset(new AsyncIO());
+        return true;
+    }
+
+    void evict(int id) {
+        Block &b = blocks[id];
+        lru.erase(b.lruPos);
+        b.data.clear();
+        b.data.shrink_to_fit();
+        b.resident = false;
+        residentBytes -= b.length;
+        pageOuts++;
+    }
+
+    // A short read or a checksum mismatch leaves the block on disk only
+    bool pageIn(int id) {
+        Block &b = blocks[id];
+        string data(b.length, '\0');
+        future<int> done = io->read(spillFd, &data[0], b.length, b.spillOffset);
+        io->submit();
+        if(done.get() != (int)b.length) {
+            cout << "Spill read failed for block " << id << "\n";
+            return false;
+        }
+        if(!verify(id, data)) return false;
+        b.data = move(data);
+        b.resident = true;
+        b.lruPos = lru.insert(lru.begin(), id);
+        residentBytes += b.length;
+        pageIns++;
+        return true;
+    }
+
+    // Apply the spill writes that completed since the last call
+    void reap() {
+        vector<pair<long long, int>> finished;
+        {
+            lock_guard<mutex> lock(doneMtx);
+            finished.swap(done);
+        }
+        for(auto &f : finished) {
+            auto it = writes.find(f.first);
+            int id = it->second;
+            writes.erase(it);
+            if(id < 0) {                            // released while writing
+                freeSlots.push_back(f.first);
+                continue;
+            }
+            Block &b = blocks[id];
+            b.writing = false;
+            if(f.second != (int)b.length) {
+                cout << "Spill write failed\n";
+                freeSlots.push_back(b.spillOffset);
+                b.spillOffset = -1;                 // keep it in memory
+            }
+        }
+    }
+
+    // Spill from the cold end until we are within budget, never evicting
+    // `keep`. Blocks already on disk are dropped now; the rest are written
+    // as one batch and dropped by a later pass once their write completes.
+    void enforceBudget(int keep) {
+        reap();
+        if(memoryBudget == 0 || residentBytes <= memoryBudget) return;
+        if(!openSpill()) return;
+
+        vector<int> victims;
+        size_t freed = 0;
+        for(auto it = lru.rbegin(); it != lru.rend() && residentBytes - freed > memoryBudget; it++) {
+            if(*it == keep) continue;
+            victims.push_back(*it);
+            freed += blocks[*it].length;
+        }
+
+        bool queued = false;
+        for(int id : victims) {
+            Block &b = blocks[id];
+            if(b.writing) continue;
+            if(b.spillOffset >= 0) {                // already on disk
+                evict(id);
+                continue;
+            }
+            if(freeSlots.empty()) {
+                b.spillOffset = spillEnd;
+                spillEnd += BLOCK_SIZE;
+            } else {
+                b.spillOffset = freeSlots.back();
+                freeSlots.pop_back();
+            }
+            b.writing = true;
+            writes[b.spillOffset] = id;
+
+            // The write gets its own copy; the block may move or be freed meanwhile
+            auto copy = make_shared<string>(b.data);
+            long long slot = b.spillOffset;
+            io->write(spillFd, copy->data(), copy->size(), slot, [this, copy, slot](int res) {
+                lock_guard<mutex> lock(doneMtx);
+                done.push_back({slot, res});
+                doneCv.notify_all();
+            });
+            queued = true;
+        }
+        if(queued) io->submit();
+    }
+
+    // Mark `id` as just read, paging it in if needed; false if it can't be read
+    bool touch(int id) {
+        Block &b = blocks[id];
+        if(!b.resident) {
+            if(!pageIn(id)) return false;
+        } else {
+            lru.splice(lru.begin(), lru, b.lruPos);
+        }
+        enforceBudget(id);
+        return true;
+    }
+
+public:
+    ~BlockStore() {
+        io.reset();
+        if(spillFd >= 0) close(spillFd);
+    }
+
+    // Fast non-cryptographic hash, 8 bytes per step.
+    static uint64_t hashBytes(const char* p, size_t n) {
+        uint64_t h = 0x9E3779B97F4A7C15ULL ^ n;
+        size_t i = 0;
+        for(; i + 8 <= n; i += 8) {
+            uint64_t k;
+            memcpy(&k, p + i, 8);
+            h = (h ^ k) * 0xFF51AFD7ED558CCDULL;
+            h ^= h >> 32;
+        }
+        uint64_t k = 0;
+        memcpy(&k, p + i, n - i);
+        h = (h ^ k) * 0xC4CEB9FE1A85EC53ULL;
+        return h ^ (h >> 29);
+    }
+
+    // Returns the id of a block holding `data`, sharing an existing one if possible.
+    int intern(const string& data) {
+        uint64_t h = hashBytes(data.data(), data.size());
+        logicalBytes += data.size();
+
+        auto range = index.equal_range(h);
+        for(auto it = range.first; it != range.second; it++) {
+            if(blocks[it->second].length != data.size()) continue;
+            if(!touch(it->second)) continue;
+            Block &b = blocks[it->second];
+            if(b.data == data) {        // verify, hashes can collide
+                b.refCount++;
+                return it->second;
+            }
+        }
+
+        int id;
+        uint32_t crc = Crc32c::instance().compute(data.data(), data.size());
+        Block block = {data, h, crc, 1, data.size(), -1, true, false, {}};
+        if(!freeIds.empty()) {
+            id = freeIds.back();
+            freeIds.pop_back();
+            blocks[id] = block;
+        } else {
+            id = blocks.size();
+            blocks.push_back(block);
+        }
+        index.insert({h, id});
+        storedBytes += data.size();
+        residentBytes += data.size();
+        blocks[id].lruPos = lru.insert(lru.begin(), id);
+        enforceBudget(id);
+        return id;
+    }
+
+    void release(int id) {
+        Block &b = blocks[id];
+        logicalBytes -= b.length;
+        if(--b.refCount > 0) return;
+
+        auto range = index.equal_range(b.hash);
+        for(auto it = range.first; it != range.second; it++) {
+            if(it->second == id) {
+                index.erase(it);
+                break;
+            }
+        }
+        storedBytes -= b.length;
+        if(b.writing) {
+            writes[b.spillOffset] = -1;         // reap() frees the slot
+            b.writing = false;
+        } else if(b.spillOffset >= 0) {
+            freeSlots.push_back(b.spillOffset);
+        }
+        b.spillOffset = -1;
+        if(b.resident) {
+            lru.erase(b.lruPos);
+            residentBytes -= b.length;
+        }
+        b.data.clear();
+        b.data.shrink_to_fit();
+        freeIds.push_back(id);
+    }
+
+    // Block contents, or nullptr if they can't be read back intact.
+    // The pointer is valid until the next call into the store.
+    const string* get(int id) {
+        if(!touch(id)) return nullptr;
+        if(verifyOnRead && !verify(id, blocks[id].data)) return nullptr;
+        return &blocks[id].data;
+    }
+
+    // Check `data` against block `id`'s checksum; thread-safe
+    bool verify(int id, const string &data) {
+        if(Crc32c::instance().compute(data.data(), data.size()) == blocks[id].crc) return true;
+        checksumFailures++;
+        cout << "Checksum mismatch in block " << id << "\n";
+        return false;
+    }
+
+    void setVerifyOnRead(bool enabled) {
+        verifyOnRead = enabled;
+    }
+
+    bool verifying() {
+        return verifyOnRead;
+    }
+
+    size_t failures() {
+        return checksumFailures;
+    }
+
+    // Ids below this bound may be live blocks
+    size_t idBound() {
+        return blocks.size();
+    }
+
+    bool isLive(int id) {
+        return blocks[id].refCount > 0;
+    }
+
+    size_t length(int id) {
+        return blocks[id].length;
+    }
+
+    // Read-only access for parallel scans, which must not reorder the LRU.
+    // Only safe while no other thread calls into the store.
+    const string* residentData(int id) {
+        return blocks[id].resident ? &blocks[id].data : nullptr;
+    }
+
+    // Copy a spilled block into `out` without paging it in; thread-safe.
+    // False on a short read or a checksum mismatch.
+    bool readSpilled(int id, string &out) {
+        Block &b = blocks[id];
+        out.resize(b.length);
+        future<int> done = io->read(spillFd, &out[0], b.length, b.spillOffset);
+        io->submit();
+        if(done.get() != (int)b.length) {
+            cout << "Spill read failed for block " << id << "\n";
+            return false;
+        }
+        return verify(id, out);
+    }
+
+    // Unlike reads, this waits for the spill writes it needs, so the store is
+    // within budget on return: the first pass writes out cold blocks, the
+    // second evicts them
+    void setMemoryBudget(size_t bytes) {
+        memoryBudget = bytes;
+        for(int pass = 0; pass < 2; pass++) {
+            {
+                unique_lock<mutex> lock(doneMtx);
+                doneCv.wait(lock, [&] { return done.size() == writes.size(); });
+            }
+            enforceBudget(-1);
+        }
+    }
+
+    TierStats tierStats() {
+        reap();
+        return {residentBytes, storedBytes - residentBytes, pageIns, pageOuts, (size_t)spillEnd};
+    }
+
+    // Heap bytes held by block contents and the tables tracking them
+    size_t memoryUsage() {
+        size_t bytes = blocks.capacity() * sizeof(Block) + freeIds.capacity() * sizeof(int)
+                     + hashTableBytes(index) + lru.size() * (2 * sizeof(void*) + sizeof(int));
+        for(auto &b : blocks) bytes += stringHeapBytes(b.data);
+        return bytes;
+    }
+
+    // Renumber live blocks densely and rebuild the tables at their current
+    // size. Returns old id -> new id (-1 for free slots); the caller must
+    // remap every File::blocks.
+    vector<int> compact() {
+        vector<int> remap(blocks.size(), -1);
+        vector<Block> live;
+        live.reserve(blocks.size() - freeIds.size());
+        for(size_t id = 0; id < blocks.size(); id++) {
+            if(blocks[id].refCount == 0) continue;
+            remap[id] = live.size();
+            live.push_back(move(blocks[id]));
+            live.back().data.shrink_to_fit();
+        }
+        blocks.swap(live);
+        vector<int>().swap(freeIds);
+
+        unordered_multimap<uint64_t, int> fresh;
+        fresh.reserve(blocks.size());
+        for(size_t id = 0; id < blocks.size(); id++) fresh.insert({blocks[id].hash, (int)id});
+        index.swap(fresh);
+
+        for(auto it = lru.begin(); it != lru.end(); it++) {
+            *it = remap[*it];
+            blocks[*it].lruPos = it;
+        }
+        for(auto &w : writes) {
+            if(w.second >= 0) w.second = remap[w.second];
+        }
+
+        // Give free slots at the end of the spill file back to the filesystem
+        sort(freeSlots.begin(), freeSlots.end());
+        while(!freeSlots.empty() && freeSlots.back() == spillEnd - (long long)BLOCK_SIZE) {
+            freeSlots.pop_back();
+            spillEnd -= BLOCK_SIZE;
+        }
+        if(spillFd >= 0 && ftruncate(spillFd, spillEnd) != 0) cout << "Spill truncate failed\n";
+        freeSlots.shrink_to_fit();
+        return remap;
+    }
+
+    DedupStats stats() {
+        size_t unique = blocks.size() - freeIds.size();
+        double ratio = storedBytes == 0 ? 1.0 : (double)logicalBytes / storedBytes;
+        return {logicalBytes, storedBytes, unique, ratio};
+    }
+};
+
+// One directory entry naming a file
+struct Link {
+    Directory* dir;
+    int nameId;
+};
+
+// A File is an inode: several directory entries (hard links) may point at it.
+// It is freed once the last link is gone and no handle has it open. Its
+// parent and nameId always describe links[0].
+class File : public Node {
+public:
+    BlockStore* store;
+    vector<int> blocks;     // block ids in content order
+    size_t size;
+    vector<Link> links;     // every entry pointing here
+    int openHandles;
+
+    File(BlockStore* store) : Node(true) {
+        this->store = store;
+        this->size = 0;
+        this->openHandles = 0;
+    }
+
+    void linkFrom(Directory* dir, int id) {
+        links.push_back({dir, id});
+        if(links.size() == 1) {
+            parent = dir;
+            nameId = id;
+        }
+    }
+
+    void unlinkFrom(Directory* dir, int id) {
+        for(size_t i = 0; i < links.size(); i++) {
+            if(links[i].dir == dir && links[i].nameId == id) {
+                links.erase(links.begin() + i);
+                break;
+            }
+        }
+        parent = links.empty() ? nullptr : links[0].dir;
+        nameId = links.empty() ? -1 : links[0].nameId;
+    }
+
+    bool unreferenced() {
+        return links.empty() && openHandles == 0;
+    }
+
+    ~File() {
+        for(int id : blocks) store->release(id);
+    }
+
+    // False, with the file unchanged, if the partial last block can't be read
+    bool appendContent(string data) {
+        // Only the last block may be partial; re-chunk it together with the new data.
+        string tail;
+        if(!blocks.empty() && store->length(blocks.back()) < BLOCK_SIZE) {
+            const string* last = store->get(blocks.back());
+            if(last == nullptr) return false;
+            tail = *last;
+            store->release(blocks.back());
+            blocks.pop_back();
+        }
+        tail += data;
+
+        for(size_t off = 0; off < tail.size(); off += BLOCK_SIZE) {
+            blocks.push_back(store->intern(tail.substr(off, BLOCK_SIZE)));
+        }
+        size += data.size();
+        modifiedNs = nowNs();
+        return true;
+    }
+
+    // False if a block can't be read back intact
+    bool getContent(string &content) {
+        content.clear();
+        content.reserve(size);
+        for(int id : blocks) {
+            const string* data = store->get(id);
+            if(data == nullptr) return false;
+            content += *data;
+        }
+        return true;
+    }
+
+    // Up to `n` bytes starting at `offset`; every block but the last is full
+    bool readRange(size_t offset, size_t n, string &out) {
+        out.clear();
+        if(offset >= size) return true;
+        n = min(n, size - offset);
+        out.reserve(n);
+
+        size_t b = offset / BLOCK_SIZE;
+        size_t off = offset % BLOCK_SIZE;
+        while(out.size() < n) {
+            const string* data = store->get(blocks[b++]);
+            if(data == nullptr) return false;
+            size_t take = min(n - out.size(), data->size() - off);
+            out.append(*data, off, take);
+            off = 0;
+        }
+        return true;
+    }
+
+    void truncate() {
+        for(int id : blocks) store->release(id);
+        blocks.clear();
+        size = 0;
+        modifiedNs = nowNs();
+    }
+};
+
+// ---------------- CHILDREN CONTAINER ----------------
+// Small directories keep their entries in a short inline array searched
+// linearly, comparing 4 name ids at a time with SSE2. Past INLINE_CAPACITY the
+// container promotes itself to a hash map.
+class ChildMap {
+public:
+    static const int INLINE_CAPACITY = 8;
+
+private:
+    alignas(16) int ids[INLINE_CAPACITY];       // name ids of inline entries
+    Node* nodes[INLINE_CAPACITY];
+    int count;                                  // inline entries in use
+    unordered_map<int, Node*>* map;             // non-null once promoted
+
+    int findInline(int id) {
+#ifdef __SSE2__
+        __m128i needle = _mm_set1_epi32(id);
+        __m128i lo = _mm_cmpeq_epi32(_mm_load_si128((const __m128i*)ids), needle);
+        __m128i hi = _mm_cmpeq_epi32(_mm_load_si128((const __m128i*)(ids + 4)), needle);
+        unsigned mask = _mm_movemask_ps(_mm_castsi128_ps(lo))
+                      | _mm_movemask_ps(_mm_castsi128_ps(hi)) << 4;
+        mask &= (1u << count) - 1;
+        return mask ? __builtin_ctz(mask) : -1;
+#else
+        for(int i = 0; i < count; i++) {
+            if(ids[i] == id) return i;
+        }
+        return -1;
+#endif
+    }
+
+    void promote() {
+        map = new unordered_map<int, Node*>();
+        map->reserve(count * 2);
+        for(int i = 0; i < count; i++) (*map)[ids[i]] = nodes[i];
+        count = 0;
+    }
+
+public:
+    ChildMap() {
+        fill(ids, ids + INLINE_CAPACITY, -1);
+        count = 0;
+        map = nullptr;
+    }
+
+    ~ChildMap() {
+        delete map;
+    }
+
+    size_t size() {
+        return map ? map->size() : count;
+    }
+
+    size_t heapBytes() {
+        return map ? hashTableBytes(*map) : 0;
+    }
+
+    // Shrink a promoted map left oversized by deletions, moving back to
+    // inline storage if the entries fit
+    void compact() {
+        if(!map) return;
+        if(map->size() <= INLINE_CAPACITY) {
+            fill(ids, ids + INLINE_CAPACITY, -1);
+            count = 0;
+            for(auto &it : *map) {
+                ids[count] = it.first;
+                nodes[count] = it.second;
+                count++;
+            }
+            delete map;
+            map = nullptr;
+            return;
+        }
+        unordered_map<int, Node*>* fresh = new unordered_map<int, Node*>();
+        fresh->reserve(map->size());
+        fresh->insert(map->begin(), map->end());
+        delete map;
+        map = fresh;
+    }
+
+    Node* find(int id) {
+        if(map) {
+            auto it = map->find(id);
+            return it == map->end() ? nullptr : it->second;
+        }
+        int i = findInline(id);
+        return i < 0 ? nullptr : nodes[i];
+    }
+
+    void insert(int id, Node* node) {
+        if(map) {
+            (*map)[id] = node;
+            return;
+        }
+
+        int i = findInline(id);
+        if(i >= 0) {
+            nodes[i] = node;
+            return;
+        }
+        if(count == INLINE_CAPACITY) {
+            promote();
+            (*map)[id] = node;
+            return;
+        }
+
+        ids[count] = id;
+        nodes[count] = node;
+        count++;
+    }
+
+    void erase(int id) {
+        if(map) {
+            map->erase(id);
+            return;
+        }
+
+        int i = findInline(id);
+        if(i < 0) return;
+        count--;                    // order does not matter, move the last entry in
+        ids[i] = ids[count];
+        nodes[i] = nodes[count];
+        ids[count] = -1;
+    }
+
+    template<typename F>
+    void forEach(F f) {
+        if(map) {
+            for(auto &it : *map) f(it.first, it.second);
+        } else {
+            for(int i = 0; i < count; i++) f(ids[i], nodes[i]);
+        }
+    }
+};
+
+class Directory : public Node {
+public:
+    NameTable* names;   // the owning filesystem's table
+    ChildMap children;
+
+    // Aggregates over the whole subtree, kept up to date on every write/rm
+    size_t totalBytes;
+    size_t fileCount;
+    size_t quota;       // max totalBytes, 0 = unlimited
+
+    Directory(NameTable* names) : Node(false) {
+        this->names = names;
+        totalBytes = 0;
+        fileCount = 0;
+        quota = 0;
+    }
+
+    ~Directory() {
+        children.forEach([this](int id, Node* child) {
+            if(child->isFile) dynamic_cast<File*>(child)->unlinkFrom(this, id);
+            release(child);
+            names->release(id);
+        });
+    }
+
+    // Free a node that is no longer in the tree; files may live on through other links
+    static void release(Node* node) {
+        if(node->isFile && !dynamic_cast<File*>(node)->unreferenced()) return;
+        delete node;
+    }
+
+    bool hasChild(string name) {
+        return getChild(name) != nullptr;
+    }
+
+    Node* getChild(string name) {
+        int id = names->lookup(name);
+        return id < 0 ? nullptr : children.find(id);
+    }
+
+    void addChild(string name, Node* node) {
+        int id = names->intern(name);
+        if(node->isFile) {
+            dynamic_cast<File*>(node)->linkFrom(this, id);
+        } else {
+            node->parent = this;
+            node->nameId = id;
+        }
+        children.insert(id, node);
+        modifiedNs = nowNs();
+    }
+
+    // ✅ NEW FUNCTION
+    void removeChild(string name) {
+        int id = names->lookup(name);
+        Node* node = id < 0 ? nullptr : children.find(id);
+        if(node != nullptr) {
+            children.erase(id);          // remove from map
+            if(node->isFile) dynamic_cast<File*>(node)->unlinkFrom(this, id);
+            release(node);               // free memory
+            names->release(id);
+            modifiedNs = nowNs();
+        }
+    }
+
+    // Unlink a child without freeing it (used by mv)
+    Node* detachChild(string name) {
+        int id = names->lookup(name);
+        Node* node = children.find(id);
+        children.erase(id);
+        if(node->isFile) dynamic_cast<File*>(node)->unlinkFrom(this, id);
+        else {
+            node->parent = nullptr;
+            node->nameId = -1;
+        }
+        names->release(id);
+        modifiedNs = nowNs();
+        return node;
+    }
+};
+
+// ---------------- CHANGE NOTIFICATIONS ----------------
+enum EventType {
+    EVENT_CREATE = 0,
+    EVENT_MODIFY,
+    EVENT_DELETE,
+    EVENT_MOVE,
+    EVENT_OVERFLOW      // events were dropped because the ring was full
+};
+
+struct FsEvent {
+    EventType type;
+    string path;
+    string toPath;      // destination, only set for EVENT_MOVE
+};
+
+// Bounded per-watcher queue. A modify on a file that already has a pending
+// modify is coalesced into it; when full, new events are dropped and a single
+// EVENT_OVERFLOW is reported on the next drain.
+class EventRing {
+private:
+    vector<FsEvent> slots;
+    size_t head;
+    size_t count;
+    bool overflowed;
+    unordered_set<string> pendingModify;
+
+public:
+    EventRing(size_t capacity) : slots(capacity) {
+        head = 0;
+        count = 0;
+        overflowed = false;
+    }
+
+    void push(const FsEvent &ev) {
+        if(ev.type == EVENT_MODIFY) {
+            if(pendingModify.count(ev.path)) return;
+        } else {
+            // Later modifies must not fold into one that precedes this event
+            pendingModify.erase(ev.path);
+            if(ev.type == EVENT_MOVE) pendingModify.erase(ev.toPath);
+        }
+
+        if(count == slots.size()) {
+            overflowed = true;
+            return;
+        }
+
+        slots[(head + count) % slots.size()] = ev;
+        count++;
+        if(ev.type == EVENT_MODIFY) pendingModify.insert(ev.path);
+    }
+
+    vector<FsEvent> drain(size_t maxEvents) {
+        vector<FsEvent> batch;
+        if(overflowed && maxEvents > 0) {
+            batch.push_back({EVENT_OVERFLOW, "", ""});
+            overflowed = false;
+        }
+
+        while(count > 0 && batch.size() < maxEvents) {
+            FsEvent &ev = slots[head];
+            if(ev.type == EVENT_MODIFY) pendingModify.erase(ev.path);
+            batch.push_back(move(ev));
+            head = (head + 1) % slots.size();
+            count--;
+        }
+        return batch;
+    }
+};
+
+struct Watcher {
+    string path;        // normalized, "/" or "/a/b"
+    bool recursive;
+    EventRing ring;
+
+    Watcher(string path, bool recursive, size_t capacity)
+        : path(path), recursive(recursive), ring(capacity) {}
+
+    bool covers(const string &p) {
+        if(p.empty()) return false;
+        if(p == path) return true;
+
+        string prefix = path == "/" ? "/" : path + "/";
+        if(p.compare(0, prefix.size(), prefix) != 0) return false;
+        // Non-recursive watches only see direct children
+        return recursive || p.find('/', prefix.size()) == string::npos;
+    }
+};
+
+// ---------------- FILE HANDLES ----------------
+enum OpenMode {
+    MODE_READ = 0,
+    MODE_WRITE,         // truncate on open
+    MODE_APPEND
+};
+
+class FileSystem;
+
+// Caches the resolved File* and buffers small writes into one append.
+// Buffered data is not visible to readers until flush()/close(). Like a Unix
+// descriptor, an open handle keeps working after its file is removed.
+// If an append is rejected (quota), the buffer is kept and flush()/close()
+// return false, so the caller can free space and retry.
+class FileHandle {
+private:
+    FileSystem* fs;
+    File* file;         // nullptr once closed; holds a reference on the file
+    OpenMode mode;
+    string buffer;
+    size_t readOffset;
+
+    friend class FileSystem;
+
+public:
+    static const size_t BUFFER_SIZE = 64 * 1024;
+
+    FileHandle(FileSystem* fs, File* file, OpenMode mode) {
+        this->fs = fs;
+        this->file = file;
+        this->mode = mode;
+        this->readOffset = 0;
+    }
+
+    ~FileHandle() {
+        flush();
+        release();      // whatever could not be flushed is dropped
+    }
+
+    bool isOpen() {
+        return file != nullptr;
+    }
+
+    size_t write(const string &data);      // bytes accepted, 0 on error
+    string read(size_t n);
+    bool flush();
+    bool close();       // false if buffered data could not be written; the handle stays open
+
+private:
+    void release();
+};
+
+// ---------------- PARALLEL TASK POOL ----------------
+// Work-stealing pool: every worker owns a deque, pushes and pops its own
+// tasks at the back and steals from the front of other workers' deques when
+// it runs dry. Tasks spawned from a worker stay local, so a subtree tends to
+// be walked by the thread that discovered it.
+class TaskPool {
+private:
+    struct Worker {
+        deque<function<void()>> tasks;
+        mutex mtx;
+    };
+
+    vector<unique_ptr<Worker>> workers;
+    vector<thread> threads;
+    atomic<long> pending;           // spawned but not finished
+    atomic<long> queued;            // sitting in some deque
+    atomic<unsigned> nextWorker;    // round robin for spawns from outside the pool
+    bool stopping;
+    mutex sleepMtx;
+    condition_variable wake;
+    condition_variable idle;
+
+    static thread_local TaskPool* currentPool;
+    static thread_local int currentIndex;
+
+    bool popLocal(int index, function<void()> &task) {
+        Worker &w = *workers[index];
+        lock_guard<mutex> lock(w.mtx);
+        if(w.tasks.empty()) return false;
+        task = move(w.tasks.back());
+        w.tasks.pop_back();
+        return true;
+    }
+
+    bool steal(int thief, function<void()> &task) {
+        for(size_t k = 1; k < workers.size(); k++) {
+            Worker &w = *workers[(thief + k) % workers.size()];
+            lock_guard<mutex> lock(w.mtx);
+            if(w.tasks.empty()) continue;
+            task = move(w.tasks.front());
+            w.tasks.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    void run(int index) {
+        currentPool = this;
+        currentIndex = index;
+
+        while(true) {
+            function<void()> task;
+            if(popLocal(index, task) || steal(index, task)) {
+                queued--;
+                task();
+                if(--pending == 0) {
+                    lock_guard<mutex> lock(sleepMtx);
+                    idle.notify_all();
+                }
+                continue;
+            }
+
+            unique_lock<mutex> lock(sleepMtx);
+            wake.wait(lock, [&] { return stopping || queued > 0; });
+            if(stopping && queued == 0) return;
+        }
+    }
+
+public:
+    TaskPool(size_t threadCount = 0) : pending(0), queued(0), nextWorker(0) {
+        if(threadCount == 0) threadCount = max(1u, thread::hardware_concurrency());
+        stopping = false;
+        for(size_t i = 0; i < threadCount; i++) workers.emplace_back(new Worker());
+        for(size_t i = 0; i < threadCount; i++) threads.emplace_back(&TaskPool::run, this, i);
+    }
+
+    ~TaskPool() {
+        {
+            lock_guard<mutex> lock(sleepMtx);
+            stopping = true;
+        }
+        wake.notify_all();
+        for(thread &t : threads) t.join();
+    }
+
+    size_t size() {
+        return workers.size();
+    }
+
+    // Index of the calling worker in this pool, -1 for outside threads
+    int workerIndex() {
+        return currentPool == this ? currentIndex : -1;
+    }
+
+    void spawn(function<void()> task) {
+        int index = workerIndex();
+        if(index < 0) index = nextWorker++ % workers.size();
+
+        pending++;
+        {
+            lock_guard<mutex> lock(workers[index]->mtx);
+            workers[index]->tasks.push_back(move(task));
+        }
+        queued++;
+
+        lock_guard<mutex> lock(sleepMtx);
+        wake.notify_one();
+    }
+
+    // Block until every spawned task, including tasks they spawned, is done.
+    // Must be called from outside the pool.
+    void wait() {
+        unique_lock<mutex> lock(sleepMtx);
+        idle.wait(lock, [&] { return pending == 0; });
+    }
+};
+
+thread_local TaskPool* TaskPool::currentPool = nullptr;
+thread_local int TaskPool::currentIndex = -1;
+
+// ---------------- INTEGRITY ----------------
+struct ScrubReport {
+    size_t blocksChecked;
+    vector<int> corruptBlocks;
+    vector<string> corruptFiles;    // every path whose content uses a corrupt block
+};
+
+// ---------------- METADATA ----------------
+struct FileStat {
+    bool exists;
+    bool isFile;
+    size_t size;            // subtree bytes for directories
+    size_t childCount;
+    size_t linkCount;       // directory entries naming this file
+    int64_t createdNs;
+    int64_t modifiedNs;
+};
+
+struct MemoryUsage {
+    size_t nodeBytes;       // directory and file objects with their block lists
+    size_t nameBytes;       // the filesystem's name table
+    size_t mapBytes;        // children maps of large directories
+    size_t contentBytes;    // blocks and the block store's tables
+    size_t totalBytes;
+};
+
+// ---------------- CONTENT SEARCH ----------------
+struct GrepMatch {
+    string path;
+    vector<size_t> offsets;     // byte offsets of every match in the file
+};
+
+// Append base + i for every occurrence of `needle` at hay[i]. Candidate
+// positions are filtered on the needle's first and last byte, 32 (AVX2) or
+// 16 (SSE2) positions per step, and only candidates are compared in full.
+void simdSearch(const char* hay, size_t n, const string &needle, size_t base, vector<size_t> &out) {
+    size_t m = needle.size();
+    if(m == 0 || n < m) return;
+
+    size_t i = 0;
+#if defined(__AVX2__)
+    __m256i first = _mm256_set1_epi8(needle[0]);
+    __m256i last = _mm256_set1_epi8(needle[m - 1]);
+    for(; i + m - 1 + 32 <= n; i += 32) {
+        __m256i bf = _mm256_loadu_si256((const __m256i*)(hay + i));
+        __m256i bl = _mm256_loadu_si256((const __m256i*)(hay + i + m - 1));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(bf, first),
+                                                              _mm256_cmpeq_epi8(bl, last)));
+        while(mask) {
+            int bit = __builtin_ctz(mask);
+            if(memcmp(hay + i + bit, needle.data(), m) == 0) out.push_back(base + i + bit);
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__SSE2__)
+    __m128i first = _mm_set1_epi8(needle[0]);
+    __m128i last = _mm_set1_epi8(needle[m - 1]);
+    for(; i + m - 1 + 16 <= n; i += 16) {
+        __m128i bf = _mm_loadu_si128((const __m128i*)(hay + i));
+        __m128i bl = _mm_loadu_si128((const __m128i*)(hay + i + m - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(bf, first),
+                                                        _mm_cmpeq_epi8(bl, last)));
+        while(mask) {
+            int bit = __builtin_ctz(mask);
+            if(memcmp(hay + i + bit, needle.data(), m) == 0) out.push_back(base + i + bit);
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for(; i + m <= n; i++) {
+        if(hay[i] == needle[0] && memcmp(hay + i, needle.data(), m) == 0) out.push_back(base + i);
+    }
+}
+
+// ---------------- METRICS ----------------
+enum FsOp {
+    FS_LS = 0,
+    FS_MKDIR,
+    FS_APPEND,
+    FS_OPEN,
+    FS_READ,
+    FS_RM,
+    FS_MV,
+    FS_WATCH,
+    FS_UNWATCH,
+    FS_POLL,
+    FS_DU,
+    FS_SET_QUOTA,
+    FS_DEDUP_STATS,
+    FS_SET_MEMORY_BUDGET,
+    FS_TIER_STATS,
+    FS_WALK,
+    FS_GLOB,
+    FS_GREP,
+    FS_BATCH,
+    FS_EXISTS,
+    FS_EXPORT,
+    FS_LINK,
+    FS_SCRUB,
+    FS_STAT,
+    FS_STAT_MANY,
+    FS_MEMORY_USAGE,
+    FS_COMPACT,
+    FS_HANDLE_WRITE,
+    FS_HANDLE_READ,
+    FS_HANDLE_FLUSH,
+    FS_HANDLE_CLOSE,
+    FS_SET_VERIFY_CHECKSUMS,
+    FS_SET_MUTATION_LISTENER,
+    FS_SET_SLOW_OP_TRACING,
+    FS_OP_COUNT
+};
+
+const char* FS_OP_NAMES[] = {
+    "ls", "mkdir", "addContentToFile", "open", "readContentFromFile", "rm", "mv",
+    "watch", "unwatch", "poll", "du", "setQuota", "dedupStats", "setMemoryBudget",
+    "tierStats", "walk", "glob", "grep", "applyBatch", "exists", "exportTree", "link", "scrub",
+    "stat", "statMany", "memoryUsage", "compact", "FileHandle::write", "FileHandle::read",
+    "FileHandle::flush", "FileHandle::close", "setVerifyChecksums", "setMutationListener",
+    "setSlowOpTracing"
+};
+static_assert(sizeof(FS_OP_NAMES) / sizeof(FS_OP_NAMES[0]) == FS_OP_COUNT, "FS_OP_NAMES must name every FsOp");
+
+struct OpStats {
+    uint64_t count;
+    uint64_t totalNs;
+    uint64_t p50Ns;
+    uint64_t p99Ns;
+    uint64_t maxNs;
+};
+
+struct SlowOp {
+    FsOp op;
+    string path;
+    uint64_t ns;
+};
+
+struct MetricsSnapshot {
+    OpStats ops[FS_OP_COUNT];
+    vector<uint64_t> pathDepth[FS_OP_COUNT];    // [op][d] = calls of op on a path with d components
+    vector<uint64_t> dirSize;       // [b] = directories seen with 2^(b-1) <= entries < 2^b
+    vector<SlowOp> slowOps;         // most recent first
+};
+
+// Counters and log-linear latency histograms kept per thread, so the hot
+// path only does relaxed stores to memory no other thread writes. Readers
+// merge all threads. Latency buckets have 4 linear steps per power of two.
+class FsMetrics {
+public:
+    static const int LATENCY_BUCKETS = 256;
+    static const int MAX_DEPTH = 32;
+    static const int DIR_SIZE_BUCKETS = 33;
+    static const size_t SLOW_OPS_KEPT = 128;
+
+private:
+    struct ThreadSlot {
+        atomic<uint64_t> count[FS_OP_COUNT];
+        atomic<uint64_t> totalNs[FS_OP_COUNT];
+        atomic<uint64_t> maxNs[FS_OP_COUNT];
+        atomic<uint64_t> latency[FS_OP_COUNT][LATENCY_BUCKETS];
+        atomic<uint64_t> pathDepth[FS_OP_COUNT][MAX_DEPTH];
+        atomic<uint64_t> dirSize[DIR_SIZE_BUCKETS];
+        uint64_t slowSeen = 0;      // only touched by the owning thread
+
+        ThreadSlot() {
+            for(int op = 0; op < FS_OP_COUNT; op++) {
+                count[op] = 0;
+                totalNs[op] = 0;
+                maxNs[op] = 0;
+                for(auto &b : latency[op]) b = 0;
+                for(auto &d : pathDepth[op]) d = 0;
+            }
+            for(auto &d : dirSize) d = 0;
+        }
+    };
+
+    static atomic<uint64_t> nextId;
+    uint64_t id;                    // keys the thread-local slot cache
+    mutex slotsMtx;
+    vector<unique_ptr<ThreadSlot>> slots;
+
+    mutex traceMtx;
+    deque<SlowOp> slowOps;
+    atomic<uint64_t> slowThresholdNs;
+    atomic<uint64_t> sampleEvery;   // record 1 in N slow operations
+
+    ThreadSlot& local() {
+        thread_local unordered_map<uint64_t, ThreadSlot*> cache;
+        auto it = cache.find(id);
+        if(it != cache.end()) return *it->second;
+
+        lock_guard<mutex> lock(slotsMtx);
+        slots.emplace_back(new ThreadSlot());
+        cache[id] = slots.back().get();
+        return *slots.back();
+    }
+
+    // Single writer per slot, so no read-modify-write instruction is needed
+    static void add(atomic<uint64_t> &c, uint64_t v) {
+        c.store(c.load(memory_order_relaxed) + v, memory_order_relaxed);
+    }
+
+    static int pathDepthOf(const string &path) {
+        int depth = 0;
+        for(size_t i = 0; i < path.size(); i++) {
+            if(path[i] != '/' && (i == 0 || path[i - 1] == '/')) depth++;
+        }
+        return min(depth, MAX_DEPTH - 1);
+    }
+
+public:
+    FsMetrics() {
+        id = nextId++;
+        slowThresholdNs = 1000000;      // 1 ms
+        sampleEvery = 1;
+    }
+
+    static int bucketOf(uint64_t ns) {
+        if(ns < 4) return ns;
+        int e = 63 - __builtin_clzll(ns);
+        return (e - 1) * 4 + ((ns >> (e - 2)) & 3);
+    }
+
+    // Lower bound of a latency bucket
+    static uint64_t bucketValue(int bucket) {
+        if(bucket < 4) return bucket;
+        int e = bucket / 4 + 1;
+        return (uint64_t)(4 + bucket % 4) << (e - 2);
+    }
+
+    void record(FsOp op, const string &path, uint64_t ns) {
+        ThreadSlot &slot = local();
+        add(slot.count[op], 1);
+        add(slot.totalNs[op], ns);
+        add(slot.latency[op][bucketOf(ns)], 1);
+        if(ns > slot.maxNs[op].load(memory_order_relaxed)) slot.maxNs[op].store(ns, memory_order_relaxed);
+        if(!path.empty()) add(slot.pathDepth[op][pathDepthOf(path)], 1);
+
+        if(ns >= slowThresholdNs.load(memory_order_relaxed) && slot.slowSeen++ % sampleEvery == 0) {
+            lock_guard<mutex> lock(traceMtx);
+            slowOps.push_front({op, path, ns});
+            if(slowOps.size() > SLOW_OPS_KEPT) slowOps.pop_back();
+        }
+    }
+
+    void recordDirSize(size_t entries) {
+        int bucket = entries == 0 ? 0 : 64 - __builtin_clzll(entries);
+        add(local().dirSize[min(bucket, DIR_SIZE_BUCKETS - 1)], 1);
+    }
+
+    void setSlowOpTracing(uint64_t thresholdNs, uint64_t every) {
+        slowThresholdNs = thresholdNs;
+        sampleEvery = max<uint64_t>(every, 1);
+    }
+
+    MetricsSnapshot snapshot() {
+        MetricsSnapshot snap;
+        snap.dirSize.assign(DIR_SIZE_BUCKETS, 0);
+        vector<uint64_t> latency(LATENCY_BUCKETS);
+
+        lock_guard<mutex> lock(slotsMtx);
+        for(int op = 0; op < FS_OP_COUNT; op++) {
+            OpStats &st = snap.ops[op];
+            st = {0, 0, 0, 0, 0};
+            fill(latency.begin(), latency.end(), 0);
+            snap.pathDepth[op].assign(MAX_DEPTH, 0);
+
+            for(auto &slot : slots) {
+                st.count += slot->count[op].load(memory_order_relaxed);
+                st.totalNs += slot->totalNs[op].load(memory_order_relaxed);
+                st.maxNs = max(st.maxNs, slot->maxNs[op].load(memory_order_relaxed));
+                for(int b = 0; b < LATENCY_BUCKETS; b++) latency[b] += slot->latency[op][b].load(memory_order_relaxed);
+                for(int d = 0; d < MAX_DEPTH; d++) snap.pathDepth[op][d] += slot->pathDepth[op][d].load(memory_order_relaxed);
+            }
+
+            uint64_t seen = 0;
+            for(int b = 0; b < LATENCY_BUCKETS && st.count > 0; b++) {
+                seen += latency[b];
+                if(st.p50Ns == 0 && seen * 2 >= st.count) st.p50Ns = bucketValue(b);
+                if(seen * 100 >= st.count * 99) {
+                    st.p99Ns = bucketValue(b);
+                    break;
+                }
+            }
+        }
+
+        for(auto &slot : slots) {
+            for(int b = 0; b < DIR_SIZE_BUCKETS; b++) snap.dirSize[b] += slot->dirSize[b].load(memory_order_relaxed);
+        }
+
+        lock_guard<mutex> traceLock(traceMtx);
+        snap.slowOps.assign(slowOps.begin(), slowOps.end());
+        return snap;
+    }
+};
+
+atomic<uint64_t> FsMetrics::nextId(0);
+
+// Times one public FileSystem call from entry (including lock wait) to return
+class OpTimer {
+private:
+    FsMetrics &metrics;
+    FsOp op;
+    const string &path;
+    chrono::steady_clock::time_point start;
+
+public:
+    OpTimer(FsMetrics &metrics, FsOp op, const string &path)
+        : metrics(metrics), op(op), path(path), start(chrono::steady_clock::now()) {}
+
+    ~OpTimer() {
+        uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        metrics.record(op, path, ns);
+    }
+};
+
+// ---------------- BATCH OPERATIONS ----------------
+enum BatchOpType {
+    OP_MKDIR = 0,
+    OP_APPEND,
+    OP_RM
+};
+
+struct BatchOp {
+    BatchOpType type;
+    string path;
+    string content;     // only used by OP_APPEND
+};
+
+// ---------------- MUTATION LOG ----------------
+enum LogOp {
+    LOG_MKDIR = 0,
+    LOG_APPEND,         // creates the file if missing, arg is the appended data
+    LOG_RM,
+    LOG_MV,             // arg is the destination
+    LOG_LINK,           // path is the existing file, arg the new name
+    LOG_TRUNCATE
+};
+
+struct LogRecord {
+    LogOp op;
+    string path;
+    string arg;
+};
+
+class FileSystem {
+private:
+    NameTable names;
+    Directory* root;
+    BlockStore store;
+    unordered_map<int, Watcher*> watchers;
+    int nextWatchId = 1;
+    unordered_set<FileHandle*> handles;
+    recursive_mutex mtx;
+    unique_ptr<TaskPool> pool;      // created on first parallel traversal
+    FsMetrics stats;
+    const string noPath;
+
+    friend class FileHandle;
+
+    // Remembers the directories of the last resolved path so the next path
+    // only walks the components it does not share with it
+    struct PathCursor {
+        vector<string> parts;
+        vector<Directory*> dirs;    // dirs[i] = directory for parts[0..i)
+    };
+
+    enum UndoKind {
+        UNDO_CREATED = 0,
+        UNDO_APPENDED,
+        UNDO_REMOVED
+    };
+
+    struct UndoEntry {
+        UndoKind kind;
+        Directory* parent;
+        string name;
+        Node* node;
+        size_t oldSize;
+    };
+
+    vector<FsEvent>* pendingEvents = nullptr;   // set while a batch holds back its events
+    function<void(const LogRecord&)> mutationListener;
+    vector<LogRecord>* pendingLog = nullptr;    // same, for mutation records
+
+    vector<string> split(string path) {
+        vector<string> tokens;
+        stringstream ss(path);
+        string token;
+
+        while(getline(ss, token, '/')) {
+            if(!token.empty()) tokens.push_back(token);
+        }
+        return tokens;
+    }
+
+    string join(const vector<string> &parts, size_t n) {
+        if(n == 0) return "/";
+        string path;
+        for(size_t i = 0; i < n; i++) path += "/" + parts[i];
+        return path;
+    }
+
+    string normalize(string path) {
+        vector<string> parts = split(path);
+        return join(parts, parts.size());
+    }
+
+    void deliver(const FsEvent &ev) {
+        for(auto &it : watchers) {
+            Watcher* w = it.second;
+            if(w->covers(ev.path) || w->covers(ev.toPath)) w->ring.push(ev);
+        }
+    }
+
+    void notify(EventType type, const string &path, const string &toPath = "") {
+        if(watchers.empty()) return;
+        if(pendingEvents) {
+            pendingEvents->push_back({type, path, toPath});
+            return;
+        }
+        deliver({type, path, toPath});
+    }
+
+    void logMutation(LogOp op, const string &path, const string &arg = "") {
+        if(!mutationListener) return;
+        if(pendingLog) {
+            pendingLog->push_back({op, path, arg});
+            return;
+        }
+        mutationListener({op, path, arg});
+    }
+
+    // Apply a size/file-count delta to `dir` and every ancestor
+    void propagate(Directory* dir, long long bytes, long long files) {
+        for(; dir != nullptr; dir = dir->parent) {
+            dir->totalBytes += bytes;
+            dir->fileCount += files;
+        }
+    }
+
+    // Add (sign = 1) or remove (sign = -1) a node's subtree totals above `parent`
+    void account(Directory* parent, Node* node, int sign) {
+        long long bytes, files;
+        if(node->isFile) {
+            bytes = dynamic_cast<File*>(node)->size;
+            files = 1;
+        } else {
+            Directory* dir = dynamic_cast<Directory*>(node);
+            bytes = dir->totalBytes;
+            files = dir->fileCount;
+        }
+        propagate(parent, sign * bytes, sign * files);
+    }
+
+    bool fitsQuota(Directory* dir, size_t extraBytes) {
+        for(; dir != nullptr; dir = dir->parent) {
+            if(dir->quota != 0 && dir->totalBytes + extraBytes > dir->quota) return false;
+        }
+        return true;
+    }
+
+    // Quota check for `bytes` going to the file at `parts`, before any of the
+    // path is created. New directories have no quota, so the deepest existing
+    // directory on the path decides.
+    bool pathFitsQuota(const vector<string> &parts, size_t bytes) {
+        Directory* curr = root;
+        for(size_t i = 0; i + 1 < parts.size(); i++) {
+            Node* next = curr->getChild(parts[i]);
+            if(next == nullptr || next->isFile) break;
+            curr = dynamic_cast<Directory*>(next);
+        }
+        return fitsQuota(curr, bytes);
+    }
+
+    // A file's size counts once under every directory that links to it
+    void propagateFile(File* file, long long bytes) {
+        for(auto &link : file->links) propagate(link.dir, bytes, 0);
+    }
+
+    bool fileFitsQuota(File* file, size_t extraBytes) {
+        for(auto &link : file->links) {
+            if(!fitsQuota(link.dir, extraBytes)) return false;
+        }
+        return true;
+    }
+
+    void releaseHandle(File* file) {
+        file->openHandles--;
+        if(file->unreferenced()) delete file;
+    }
+
+    string pathOf(Node* node) {
+        if(node == root) return "/";
+        string path;
+        for(; node != root; node = node->parent) {
+            path = "/" + names.get(node->nameId) + path;    // a file's first link
+        }
+        return path;
+    }
+
+    // Walk to the file at `parts`, creating missing directories and the file.
+    // nullptr if a component is a file or the target is a directory.
+    File* openFile(const vector<string> &parts) {
+        Directory* curr = root;
+
+        for(size_t i = 0; i < parts.size(); i++) {
+            const string &part = parts[i];
+
+            if(!curr->hasChild(part)) {
+                if(i == parts.size() - 1) {
+                    curr->addChild(part, new File(&store));
+                    propagate(curr, 0, 1);
+                    logMutation(LOG_APPEND, join(parts, parts.size()));     // also creates the parents
+                } else {
+                    curr->addChild(part, new Directory(&names));
+                }
+                notify(EVENT_CREATE, join(parts, i + 1));
+            }
+
+            if(i == parts.size() - 1) {
+                stats.recordDirSize(curr->children.size());
+                return dynamic_cast<File*>(curr->getChild(part));
+            }
+            Node* next = curr->getChild(part);
+            if(next->isFile) return nullptr;
+            curr = dynamic_cast<Directory*>(next);
+        }
+        return nullptr;
+    }
+
+    // Append to an already resolved file, enforcing quotas and notifying watchers.
+    // `parts` is the link the caller wrote through; without it (handles) every
+    // link is reported, and the log names the first.
+    bool appendToFile(File* file, const string &content, const vector<string>* parts = nullptr) {
+        if(!fileFitsQuota(file, content.size())) {
+            cout << "Quota exceeded\n";
+            return false;
+        }
+
+        if(!file->appendContent(content)) return false;
+        propagateFile(file, content.size());
+        // Unlinked files have no path; skip building one nobody will see
+        if(!file->parent || (!mutationListener && watchers.empty())) return true;
+        if(parts) {
+            string path = join(*parts, parts->size());
+            logMutation(LOG_APPEND, path, content);
+            notify(EVENT_MODIFY, path);
+            return true;
+        }
+        logMutation(LOG_APPEND, pathOf(file), content);
+        if(watchers.empty()) return true;
+        for(auto &link : file->links) notify(EVENT_MODIFY, childPath(pathOf(link.dir), link.nameId));
+        return true;
+    }
+
+    FileStat statNode(Node* node) {
+        if(node == nullptr) return {false, false, 0, 0, 0, 0, 0};
+        if(node->isFile) {
+            File* file = dynamic_cast<File*>(node);
+            return {true, true, file->size, 0, file->links.size(), file->createdNs, file->modifiedNs};
+        }
+        Directory* dir = dynamic_cast<Directory*>(node);
+        return {true, false, dir->totalBytes, dir->children.size(), 1, dir->createdNs, dir->modifiedNs};
+    }
+
+    // Every directory in the tree, and every file reachable from it or from
+    // an open handle, once each
+    void collectNodes(Directory* dir, vector<Directory*> &dirs, unordered_set<File*> &files) {
+        dirs.push_back(dir);
+        dir->children.forEach([&](int, Node* child) {
+            if(child->isFile) files.insert(dynamic_cast<File*>(child));
+            else collectNodes(dynamic_cast<Directory*>(child), dirs, files);
+        });
+    }
+
+    void collectNodes(vector<Directory*> &dirs, unordered_set<File*> &files) {
+        collectNodes(root, dirs, files);
+        for(FileHandle* h : handles) {
+            if(h->file) files.insert(h->file);
+        }
+    }
+
+    TaskPool& taskPool() {
+        if(!pool) pool.reset(new TaskPool());
+        return *pool;
+    }
+
+    string childPath(const string &dirPath, int nameId) {
+        return (dirPath == "/" ? "" : dirPath) + "/" + names.get(nameId);
+    }
+
+    // One task per directory; subdirectories are spawned as new tasks
+    void walkTask(Directory* dir, string dirPath, function<void(const string&, bool)> &visitor) {
+        dir->children.forEach([&](int id, Node* child) {
+            string path = childPath(dirPath, id);
+            visitor(path, child->isFile);
+            if(!child->isFile) {
+                Directory* sub = dynamic_cast<Directory*>(child);
+                pool->spawn([this, sub, path, &visitor] { walkTask(sub, path, visitor); });
+            }
+        });
+    }
+
+    void collectFiles(Directory* dir, const string &dirPath, bool recursive,
+                      vector<pair<string, File*>> &out) {
+        dir->children.forEach([&](int id, Node* child) {
+            if(child->isFile) {
+                out.push_back({childPath(dirPath, id), dynamic_cast<File*>(child)});
+            } else if(recursive) {
+                collectFiles(dynamic_cast<Directory*>(child), childPath(dirPath, id), true, out);
+            }
+        });
+    }
+
+    // Search one file block by block without assembling its content. Resident
+    // blocks are scanned in place; matches straddling a block boundary are
+    // found in a small seam built from the last needle-1 bytes seen so far.
+    vector<size_t> searchFile(File* file, const string &needle) {
+        vector<size_t> offsets;
+        string carry, seam, spilled;
+        size_t base = 0;
+
+        for(int id : file->blocks) {
+            const string* data = store.residentData(id);
+            if(data == nullptr) {
+                if(!store.readSpilled(id, spilled)) return {};
+                data = &spilled;
+            } else if(store.verifying()) {
+                store.verify(id, *data);
+            }
+
+            if(!carry.empty()) {
+                seam = carry;
+                seam.append(*data, 0, min(data->size(), needle.size() - 1));
+                simdSearch(seam.data(), seam.size(), needle, base - carry.size(), offsets);
+            }
+            simdSearch(data->data(), data->size(), needle, base, offsets);
+
+            size_t keep = needle.size() - 1;
+            if(data->size() >= keep) {
+                carry.assign(*data, data->size() - keep, keep);
+            } else {
+                carry += *data;
+                if(carry.size() > keep) carry.erase(0, carry.size() - keep);
+            }
+            base += data->size();
+        }
+
+        sort(offsets.begin(), offsets.end());
+        return offsets;
+    }
+
+    // False if some file's content can't be read
+    bool exportNode(Node* node, const string &asPath, vector<BatchOp> &ops) {
+        if(node->isFile) {
+            ops.push_back({OP_APPEND, asPath, ""});
+            return dynamic_cast<File*>(node)->getContent(ops.back().content);
+        }
+        ops.push_back({OP_MKDIR, asPath, ""});
+        bool ok = true;
+        dynamic_cast<Directory*>(node)->children.forEach([&](int id, Node* child) {
+            if(ok) ok = exportNode(child, childPath(asPath, id), ops);
+        });
+        return ok;
+    }
+
+    // Like exportNode, but as log records for a fresh replica. A file reached
+    // again through another link is sent as LOG_LINK so the replica shares it too.
+    bool snapshotNode(Node* node, const string &path, const function<void(const LogRecord&)> &listener,
+                      unordered_map<File*, string> &seen) {
+        if(node->isFile) {
+            File* file = dynamic_cast<File*>(node);
+            auto [it, fresh] = seen.emplace(file, path);
+            if(!fresh) {
+                listener({LOG_LINK, it->second, path});
+                return true;
+            }
+            string content;
+            if(!file->getContent(content)) return false;
+            listener({LOG_APPEND, path, content});
+            return true;
+        }
+        listener({LOG_MKDIR, path, ""});
+        bool ok = true;
+        dynamic_cast<Directory*>(node)->children.forEach([&](int id, Node* child) {
+            if(ok) ok = snapshotNode(child, childPath(path, id), listener, seen);
+        });
+        return ok;
+    }
+
+    static bool hasWildcard(const string &part) {
+        return part.find_first_of("*?[") != string::npos;
+    }
+
+    // Match pattern components [k..] below `dir`. "**" matches any number of directories.
+    void globTask(Directory* dir, string dirPath, const vector<string> &pattern, size_t k,
+                  vector<vector<string>> &results) {
+        const string &comp = pattern[k];
+        bool last = k + 1 == pattern.size();
+
+        if(comp == "**") {
+            if(last) {
+                dir->children.forEach([&](int id, Node* child) {
+                    string path = childPath(dirPath, id);
+                    results[pool->workerIndex()].push_back(path);
+                    if(!child->isFile) {
+                        Directory* sub = dynamic_cast<Directory*>(child);
+                        pool->spawn([=, &pattern, &results] { globTask(sub, path, pattern, k, results); });
+                    }
+                });
+                return;
+            }
+            globTask(dir, dirPath, pattern, k + 1, results);     // zero directories
+            dir->children.forEach([&](int id, Node* child) {
+                if(child->isFile) return;
+                Directory* sub = dynamic_cast<Directory*>(child);
+                string path = childPath(dirPath, id);
+                pool->spawn([=, &pattern, &results] { globTask(sub, path, pattern, k, results); });
+            });
+            return;
+        }
+
+        auto visit = [&](int id, Node* child) {
+            string path = childPath(dirPath, id);
+            if(last) {
+                results[pool->workerIndex()].push_back(path);
+            } else if(!child->isFile) {
+                Directory* sub = dynamic_cast<Directory*>(child);
+                pool->spawn([=, &pattern, &results] { globTask(sub, path, pattern, k + 1, results); });
+            }
+        };
+
+        if(!hasWildcard(comp)) {
+            // A file's nameId is its first link, not necessarily this entry
+            int id = names.lookup(comp);
+            Node* child = id < 0 ? nullptr : dir->children.find(id);
+            if(child) visit(id, child);
+            return;
+        }
+        dir->children.forEach([&](int id, Node* child) {
+            if(fnmatch(comp.c_str(), names.get(id).c_str(), FNM_PERIOD) == 0) visit(id, child);
+        });
+    }
+
+    // Resolve the directory for parts[0..n), starting from the deepest
+    // directory shared with the cursor. Fails if a component is a file.
+    Directory* resolveDir(const vector<string> &parts, size_t n, bool create,
+                          PathCursor &cursor, vector<UndoEntry>* undo) {
+        size_t k = 0;
+        while(k < n && k < cursor.parts.size() && cursor.parts[k] == parts[k]) k++;
+        cursor.parts.resize(k);
+        cursor.dirs.resize(k + 1);
+
+        Directory* curr = cursor.dirs[k];
+        for(size_t i = k; i < n; i++) {
+            if(!curr->hasChild(parts[i])) {
+                if(!create) return nullptr;
+                curr->addChild(parts[i], new Directory(&names));
+                if(undo) undo->push_back({UNDO_CREATED, curr, parts[i], nullptr, 0});
+                logMutation(LOG_MKDIR, join(parts, i + 1));
+                notify(EVENT_CREATE, join(parts, i + 1));
+            }
+
+            Node* next = curr->getChild(parts[i]);
+            if(next->isFile) return nullptr;
+            curr = dynamic_cast<Directory*>(next);
+            cursor.parts.push_back(parts[i]);
+            cursor.dirs.push_back(curr);
+        }
+        return curr;
+    }
+
+    bool applyOp(const BatchOp &op, const vector<string> &parts, PathCursor &cursor,
+                 vector<UndoEntry>* undo, vector<Node*> &removed) {
+        if(op.type == OP_MKDIR) {
+            return resolveDir(parts, parts.size(), true, cursor, undo) != nullptr;
+        }
+        if(parts.empty()) return false;
+
+        const string &name = parts.back();
+        Directory* dir = resolveDir(parts, parts.size() - 1, op.type == OP_APPEND, cursor, undo);
+        if(dir == nullptr) return false;
+
+        if(op.type == OP_RM) {
+            if(!dir->hasChild(name)) return false;
+            Node* node = dir->getChild(name);
+            account(dir, node, -1);
+            dir->detachChild(name);
+            if(undo) undo->push_back({UNDO_REMOVED, dir, name, node, 0});
+            removed.push_back(node);
+            logMutation(LOG_RM, join(parts, parts.size()));
+            notify(EVENT_DELETE, join(parts, parts.size()));
+
+            // The cursor may point into the removed subtree
+            cursor.parts.clear();
+            cursor.dirs.resize(1);
+            return true;
+        }
+
+        if(!dir->hasChild(name)) {
+            if(!fitsQuota(dir, op.content.size())) return false;
+            dir->addChild(name, new File(&store));
+            propagate(dir, 0, 1);
+            if(undo) undo->push_back({UNDO_CREATED, dir, name, nullptr, 0});
+            logMutation(LOG_APPEND, join(parts, parts.size()));
+            notify(EVENT_CREATE, join(parts, parts.size()));
+        }
+
+        Node* node = dir->getChild(name);
+        if(!node->isFile) return false;
+
+        File* file = dynamic_cast<File*>(node);
+        if(!fileFitsQuota(file, op.content.size())) return false;
+        if(undo) undo->push_back({UNDO_APPENDED, dir, name, file, file->size});
+        if(!file->appendContent(op.content)) return false;
+        propagateFile(file, op.content.size());
+        logMutation(LOG_APPEND, join(parts, parts.size()), op.content);
+        notify(EVENT_MODIFY, join(parts, parts.size()));
+        return true;
+    }
+
+    // Undo a partially applied batch, newest change first
+    void rollback(vector<UndoEntry> &undo) {
+        for(auto it = undo.rbegin(); it != undo.rend(); it++) {
+            UndoEntry &u = *it;
+
+            if(u.kind == UNDO_CREATED) {
+                // Anything created inside it has already been undone
+                account(u.parent, u.parent->getChild(u.name), -1);
+                u.parent->removeChild(u.name);
+            } else if(u.kind == UNDO_APPENDED) {
+                File* file = dynamic_cast<File*>(u.node);
+                size_t added = file->size - u.oldSize;
+                string kept;
+                if(!file->readRange(0, u.oldSize, kept)) continue;      // can't restore, keep what is there
+                file->truncate();
+                file->appendContent(kept);
+                propagateFile(file, -(long long)added);
+            } else {
+                u.parent->addChild(u.name, u.node);
+                account(u.parent, u.node, 1);
+            }
+        }
+    }
+
+    // Helper to get parent directory and last node name
+    pair<Directory*, string> getParent(string path) {
+        vector<string> parts = split(path);
+        Directory* curr = root;
+        if(parts.empty()) return {nullptr, ""};
+
+        for(int i = 0; i < parts.size() - 1; i++) {
+            if(!curr->hasChild(parts[i])) return {nullptr, ""};
+            Node* next = curr->getChild(parts[i]);
+            if(next->isFile) return {nullptr, ""};
+            curr = dynamic_cast<Directory*>(next);
+        }
+
+        return {curr, parts.back()};
+    }
+
+    Node* traverse(string path) {
+        if(path == "/") return root;
+
+        Directory* curr = root;
+        vector<string> parts = split(path);
+
+        for(int i = 0; i < parts.size(); i++) {
+            if(!curr->hasChild(parts[i])) return nullptr;
+
+            Node* next = curr->getChild(parts[i]);
+
+            if(i == parts.size() - 1) return next;
+            if(next->isFile) return nullptr;
+
+            curr = dynamic_cast<Directory*>(next);
+        }
+
+        return curr;
+    }
+
+public:
+    FileSystem() {
+        root = new Directory(&names);
+    }
+
+    ~FileSystem() {
+        for(FileHandle* h : handles) {
+            releaseHandle(h->file);
+            h->file = nullptr;
+            h->fs = nullptr;
+        }
+        delete root;
+        for(auto &it : watchers) delete it.second;
+    }
+
+    vector<string> ls(string path) {
+        OpTimer timer(stats, FS_LS, path);
+        lock_guard<recursive_mutex> lock(mtx);
+        Node* node = traverse(path);
+        vector<string> result;
+
+        if(node == nullptr) return result;
+
+        if(node->isFile) {
+            result.push_back(split(path).back());
+            return result;
+        }
+
+        Directory* dir = dynamic_cast<Directory*>(node);
+        stats.recordDirSize(dir->children.size());
+
+        dir->children.forEach([&](int id, Node*) {
+            result.push_back(names.get(id));
+        });
+
+        sort(result.begin(), result.end());
+        return result;
+    }
+
+    void mkdir(string path) {
+        OpTimer timer(stats, FS_MKDIR, path);
+        lock_guard<recursive_mutex> lock(mtx);
+        Directory* curr = root;
+        vector<string> parts = split(path);
+
+        for(size_t i = 0; i < parts.size(); i++) {
+            string &part = parts[i];
+            if(!curr->hasChild(part)) {
+                curr->addChild(part, new Directory(&names));
+                logMutation(LOG_MKDIR, join(parts, i + 1));
+                notify(EVENT_CREATE, join(parts, i + 1));
+            }
+            Node* next = curr->getChild(part);
+            if(next->isFile) {
+                cout << "Invalid path\n";
+                return;
+            }
+            curr = dynamic_cast<Directory*>(next);
+        }
+    }
+
+    void addContentToFile(string filePath, string content) {
+        OpTimer timer(stats, FS_APPEND, filePath);
+        lock_guard<recursive_mutex> lock(mtx);
+        vector<string> parts = split(filePath);
+        if(!pathFitsQuota(parts, content.size())) {
+            cout << "Quota exceeded\n";     // before openFile, so nothing gets created
+            return;
+        }
+        File* file = openFile(parts);
+        if(file == nullptr) {
+            cout << "Invalid path\n";
+            return;
+        }
+        appendToFile(file, content, &parts);
+    }
+
+    // Open a handle that skips path resolution on every read/write
+    unique_ptr<FileHandle> open(string path, OpenMode mode) {
+        OpTimer timer(stats, FS_OPEN, path);
+        lock_guard<recursive_mutex> lock(mtx);
+        File* file;
+        if(mode == MODE_READ) {
+            Node* node = traverse(path);
+            if(node == nullptr || !node->isFile) {
+                cout << "File not found\n";
+                return nullptr;
+            }
+            file = dynamic_cast<File*>(node);
+        } else {
+            file = openFile(split(path));
+            if(file == nullptr) {
+                cout << "Invalid path\n";
+                return nullptr;
+            }
+            if(mode == MODE_WRITE && file->size > 0) {
+                propagateFile(file, -(long long)file->size);
+                file->truncate();
+                logMutation(LOG_TRUNCATE, pathOf(file));
+                notify(EVENT_MODIFY, pathOf(file));
+            }
+        }
+
+        unique_ptr<FileHandle> handle(new FileHandle(this, file, mode));
+        handles.insert(handle.get());
+        file->openHandles++;
+        return handle;
+    }
+
+    string readContentFromFile(string filePath) {
+        OpTimer timer(stats, FS_READ, filePath);
+        lock_guard<recursive_mutex> lock(mtx);
+        Node* node = traverse(filePath);
+        if(node && node->isFile) {
+            File* file = dynamic_cast<File*>(node);
+            string content;
+            if(file->getContent(content)) return content;
+        }
+        return "";
+    }
+
+    // ✅ NEW DELETE API
+    void rm(string path) {
+        OpTimer timer(stats, FS_RM, path);
+        lock_guard<recursive_mutex> lock(mtx);
+        auto [parent, name] = getParent(path);
+
+        if(parent == nullptr) {
+            cout << "Invalid path\n";
+            return;
+        }
+
+        if(!parent->hasChild(name)) {
+            cout << "File/Directory not found\n";
+            return;
+        }
+
+        account(parent, parent->getChild(name), -1);
+        parent->removeChild(name);
+        logMutation(LOG_RM, normalize(path));
+        notify(EVENT_DELETE, normalize(path));
+    }
+
+    // Move a file or directory; the destination's parent must exist
+    void mv(string src, string dst) {
+        OpTimer timer(stats, FS_MV, src);
+        lock_guard<recursive_mutex> lock(mtx);
+        auto [srcParent, srcName] = getParent(src);
+        auto [dstParent, dstName] = getParent(dst);
+
+        if(srcParent == nullptr || dstParent == nullptr || !srcParent->hasChild(srcName)) {
+            cout << "Invalid path\n";
+            return;
+        }
+        if(dstParent->hasChild(dstName)) {
+            cout << "Destination already exists\n";
+            return;
+        }
+
+        Node* node = srcParent->getChild(srcName);
+        for(Directory* d = dstParent; d != nullptr; d = d->parent) {
+            if(d == node) {
+                cout << "Cannot move a directory into itself\n";
+                return;
+            }
+        }
+
+        account(srcParent, node, -1);
+        size_t bytes = node->isFile ? dynamic_cast<File*>(node)->size
+                                    : dynamic_cast<Directory*>(node)->totalBytes;
+        if(!fitsQuota(dstParent, bytes)) {
+            account(srcParent, node, 1);
+            cout << "Quota exceeded\n";
+            return;
+        }
+
+        srcParent->detachChild(srcName);
+        dstParent->addChild(dstName, node);
+        account(dstParent, node, 1);
+
+        logMutation(LOG_MV, normalize(src), normalize(dst));
+        notify(EVENT_MOVE, normalize(src), normalize(dst));
+    }
+
+    // Add another directory entry for an existing file. Both names share the
+    // same content; rm of one leaves the other intact.
+    void link(string existing, string newPath) {
+        OpTimer timer(stats, FS_LINK, newPath);
+        lock_guard<recursive_mutex> lock(mtx);
+        Node* node = traverse(existing);
+        if(node == nullptr || !node->isFile) {
+            cout << "File not found\n";
+            return;
+        }
+
+        auto [dir, name] = getParent(newPath);
+        if(dir == nullptr || name.empty()) {
+            cout << "Invalid path\n";
+            return;
+        }
+        if(dir->hasChild(name)) {
+            cout << "Destination already exists\n";
+            return;
+        }
+
+        File* file = dynamic_cast<File*>(node);
+        if(!fitsQuota(dir, file->size)) {
+            cout << "Quota exceeded\n";
+            return;
+        }
+        dir->addChild(name, file);
+        account(dir, file, 1);
+        logMutation(LOG_LINK, normalize(existing), normalize(newPath));
+        notify(EVENT_CREATE, normalize(newPath));
+    }
+
+    // Subscribe to create/modify/delete/move events under `path`
+    int watch(string path, bool recursive, size_t capacity = 1024) {
+        OpTimer timer(stats, FS_WATCH, path);
+        lock_guard<recursive_mutex> lock(mtx);
+        int id = nextWatchId++;
+        watchers[id] = new Watcher(normalize(path), recursive, capacity);
+        return id;
+    }
+
+    void unwatch(int id) {
+        OpTimer timer(stats, FS_UNWATCH, noPath);
+        lock_guard<recursive_mutex> lock(mtx);
+        if(watchers.count(id)) {
+            delete watchers[id];
+            watchers.erase(id);
+        }
+    }
+
+    // Drain up to `maxEvents` pending events for watcher `id`
+    vector<FsEvent> poll(int id, size_t maxEvents = 256) {
+        OpTimer timer(stats, FS_POLL, noPath);
+        lock_guard<recursive_mutex> lock(mtx);
+        if(!watchers.count(id)) return {};
+        return watchers[id]->ring.drain(maxEvents);
+    }
+
+    // Total bytes under `path`, O(1) thanks to the per-directory aggregates
+    size_t du(string path) {
+        OpTimer timer(stats, FS_DU, path);
+        lock_guard<recursive_mutex> lock(mtx);
+        Node* node = traverse(path);
+        if(node == nullptr) return 0;
+        if(node->isFile) return dynamic_cast<File*>(node)->size;
+        return dynamic_cast<Directory*>(node)->totalBytes;
+    }
+
+    // Limit the bytes stored under directory `path` (0 removes the limit)
+    void setQuota(string path, size_t bytes) {
+        OpTimer timer(stats, FS_SET_QUOTA, path);
+        lock_guard<recursive_mutex> lock(mtx);
+        Node* node = traverse(path);
+        if(node == nullptr || node->isFile) {
+            cout << "Directory not found\n";
+            return;
+        }
+        dynamic_cast<Directory*>(node)->quota = bytes;
+    }
+
+    DedupStats dedupStats() {
+        OpTimer timer(stats, FS_DEDUP_STATS, noPath);
+        lock_guard<recursive_mutex> lock(mtx);
+        return store.stats();
+    }
+
+    // Keep at most `bytes` of file content in memory, spilling the rest to disk
+    void setMemoryBudget(size_t bytes) {
+        OpTimer timer(stats, FS_SET_MEMORY_BUDGET, noPath);
+        lock_guard<recursive_mutex> lock(mtx);
+        store.setMemoryBudget(bytes);
+    }
+
+    TierStats tierStats() {
+        OpTimer timer(stats, FS_TIER_STATS, noPath);
+        lock_guard<recursive_mutex> lock(mtx);
+        return store.tierStats();
+    }
+
+    // Visit every node under `path` (including it) in parallel. The visitor is
+    // called concurrently from pool threads and must not call back into the
+    // FileSystem; writers are blocked until the walk completes.
+    void walk(string path, function<void(const string&, bool)> visitor) {
+        OpTimer timer(stats, FS_WALK, path);
+        lock_guard<recursive_mutex> lock(mtx);
+        Node* node = traverse(path);
+        if(node == nullptr) return;
+
+        string start = normalize(path);
+        visitor(start, node->isFile);
+        if(node->isFile) return;
+
+        taskPool().spawn([this, node, start, &visitor] {
+            walkTask(dynamic_cast<Directory*>(node), start, visitor);
+        });
+        pool->wait();
+    }
+
+    // Paths matching a shell pattern such as "/logs/*/part-*" or "/src/**/*.h".
+    // Leading literal components are resolved directly, so only the subtree
+    // under the literal prefix is searched.
+    vector<string> glob(string pattern) {
+        OpTimer timer(stats, FS_GLOB, pattern);
+        lock_guard<recursive_mutex> lock(mtx);
+        vector<string> parts = split(pattern);
+        vector<string> matches;
+
+        // "**/**" matches what "**" does, only more times
+        parts.erase(unique(parts.begin(), parts.end(), [](const string &a, const string &b) {
+            return a == "**" && b == "**";
+        }), parts.end());
+
+        size_t k = 0;
+        Node* node = root;
+        while(k < parts.size() && !hasWildcard(parts[k])) {
+            if(node->isFile) return matches;
+            node = dynamic_cast<Directory*>(node)->getChild(parts[k]);
+            if(node == nullptr) return matches;
+            k++;
+        }
+        if(k == parts.size()) {
+            matches.push_back(join(parts, parts.size()));
+            return matches;
+        }
+        if(node->isFile) return matches;
+
+        vector<vector<string>> results(taskPool().size());      // one buffer per worker
+        Directory* dir = dynamic_cast<Directory*>(node);
+        string dirPath = join(parts, k);
+        pool->spawn([&, dir, dirPath, k] { globTask(dir, dirPath, parts, k, results); });
+        pool->wait();
+
+        for(auto &r : results) matches.insert(matches.end(), r.begin(), r.end());
+        sort(matches.begin(), matches.end());
+        // Separate "**"s can still reach one path along different splits
+        matches.erase(unique(matches.begin(), matches.end()), matches.end());
+        return matches;
+    }
+
+    // Every file under `path` (just its direct files unless `recursive`) that
+    // contains `needle`, with the offsets of all matches. Files are searched
+    // in parallel, in place, without copying their content.
+    vector<GrepMatch> grep(string path, string needle, bool recursive) {
+        OpTimer timer(stats, FS_GREP, path);
+        lock_guard<recursive_mutex> lock(mtx);
+        vector<GrepMatch> matches;
+        Node* node = traverse(path);
+        if(node == nullptr || needle.empty()) return matches;
+
+        vector<pair<string, File*>> files;
+        if(node->isFile) files.push_back({normalize(path), dynamic_cast<File*>(node)});
+        else collectFiles(dynamic_cast<Directory*>(node), normalize(path), recursive, files);
+
+        vector<vector<GrepMatch>> results(taskPool().size());      // one buffer per worker
+        for(auto &f : files) {
+            pool->spawn([&, f] {
+                vector<size_t> offsets = searchFile(f.second, needle);
+                if(!offsets.empty()) results[pool->workerIndex()].push_back({f.first, move(offsets)});
+            });
+        }
+        pool->wait();
 
-    Node(string name, bool isFile) {
-        this->name = name;
-        this->isFile = isFile;
+        for(auto &r : results) matches.insert(matches.end(), r.begin(), r.end());
+        sort(matches.begin(), matches.end(), [](const GrepMatch &a, const GrepMatch &b) {
+            return a.path < b.path;
+        });
+        return matches;
     }
 
-    virtual ~Node() {}
-};
+    bool exists(string path) {
+        OpTimer timer(stats, FS_EXISTS, path);
+        lock_guard<recursive_mutex> lock(mtx);
+        return traverse(path) != nullptr;
+    }
 
-class File : public Node {
-public:
-    string content;
+    FileStat stat(string path) {
+        OpTimer timer(stats, FS_STAT, path);
+        lock_guard<recursive_mutex> lock(mtx);
+        return statNode(traverse(path));
+    }
 
-    File(string name) : Node(name, true) {}
+    // Stat many paths in one pass; sorted so siblings share their prefix walk.
+    // Results are in the order of `paths`.
+    vector<FileStat> statMany(const vector<string> &paths) {
+        OpTimer timer(stats, FS_STAT_MANY, noPath);
+        vector<pair<vector<string>, size_t>> order;
+        for(size_t i = 0; i < paths.size(); i++) order.push_back({split(paths[i]), i});
+        sort(order.begin(), order.end());
 
-    void appendContent(string data) {
-        content += data;
+        lock_guard<recursive_mutex> lock(mtx);
+        vector<FileStat> result(paths.size());
+        PathCursor cursor;
+        cursor.dirs.push_back(root);
+        for(auto &it : order) {
+            const vector<string> &parts = it.first;
+            Node* node = root;
+            if(!parts.empty()) {
+                Directory* dir = resolveDir(parts, parts.size() - 1, false, cursor, nullptr);
+                node = dir ? dir->getChild(parts.back()) : nullptr;
+            }
+            result[it.second] = statNode(node);
+        }
+        return result;
     }
 
-    string getContent() {
-        return content;
+    MemoryUsage memoryUsage() {
+        OpTimer timer(stats, FS_MEMORY_USAGE, noPath);
+        lock_guard<recursive_mutex> lock(mtx);
+        vector<Directory*> dirs;
+        unordered_set<File*> files;
+        collectNodes(dirs, files);
+
+        MemoryUsage usage = {dirs.size() * sizeof(Directory), names.memoryUsage(), 0, store.memoryUsage(), 0};
+        for(Directory* dir : dirs) usage.mapBytes += dir->children.heapBytes();
+        for(File* file : files) {
+            usage.nodeBytes += sizeof(File) + file->blocks.capacity() * sizeof(int)
+                             + file->links.capacity() * sizeof(Link);
+        }
+        usage.totalBytes = usage.nodeBytes + usage.nameBytes + usage.mapBytes + usage.contentBytes;
+        return usage;
     }
-};
 
-class Directory : public Node {
-public:
-    unordered_map<string, Node*> children;
+    // Give back slack left by deletions: renumber blocks densely, shrink block
+    // lists, children maps and the name index to their live size, and return
+    // freed heap pages to the OS. Returns the bytes reclaimed.
+    size_t compact() {
+        OpTimer timer(stats, FS_COMPACT, noPath);
+        lock_guard<recursive_mutex> lock(mtx);
+        size_t before = memoryUsage().totalBytes;
 
-    Directory(string name) : Node(name, false) {}
+        vector<Directory*> dirs;
+        unordered_set<File*> files;
+        collectNodes(dirs, files);
 
-    bool hasChild(string name) {
-        return children.find(name) != children.end();
+        vector<int> remap = store.compact();
+        for(File* file : files) {
+            for(int &id : file->blocks) id = remap[id];
+            file->blocks.shrink_to_fit();
+            file->links.shrink_to_fit();
+        }
+        for(Directory* dir : dirs) dir->children.compact();
+        names.compact();
+#ifdef __GLIBC__
+        malloc_trim(0);
+#endif
+
+        size_t after = memoryUsage().totalBytes;
+        return before > after ? before - after : 0;
     }
 
-    Node* getChild(string name) {
-        return children[name];
+    // Batch operations that recreate the subtree at `path` (normalized, parents
+    // first), for copying it into another FileSystem with applyBatch. Empty if
+    // the path is missing or some of its content can't be read.
+    vector<BatchOp> exportTree(string path) {
+        OpTimer timer(stats, FS_EXPORT, path);
+        lock_guard<recursive_mutex> lock(mtx);
+        vector<BatchOp> ops;
+        Node* node = traverse(path);
+        if(node != nullptr && !exportNode(node, normalize(path), ops)) ops.clear();
+        return ops;
     }
 
-    void addChild(string name, Node* node) {
-        children[name] = node;
+    // Verify every block's CRC32C on each read (off by default)
+    void setVerifyChecksums(bool enabled) {
+        OpTimer timer(stats, FS_SET_VERIFY_CHECKSUMS, noPath);
+        lock_guard<recursive_mutex> lock(mtx);
+        store.setVerifyOnRead(enabled);
     }
 
-    // ✅ NEW FUNCTION
-    void removeChild(string name) {
-        if(children.find(name) != children.end()) {
-            delete children[name];       // free memory
-            children.erase(name);        // remove from map
+    // Check every stored block, in memory or spilled, in parallel
+    ScrubReport scrub() {
+        OpTimer timer(stats, FS_SCRUB, noPath);
+        lock_guard<recursive_mutex> lock(mtx);
+        ScrubReport report = {0, {}, {}};
+
+        const size_t CHUNK = 1024;
+        size_t bound = store.idBound();
+        vector<vector<int>> corrupt(taskPool().size());     // one buffer per worker
+        atomic<size_t> checked(0);
+
+        for(size_t start = 0; start < bound; start += CHUNK) {
+            pool->spawn([&, start] {
+                string scratch;
+                for(size_t id = start; id < min(bound, start + CHUNK); id++) {
+                    if(!store.isLive(id)) continue;
+                    const string* data = store.residentData(id);
+                    bool intact = data != nullptr ? store.verify(id, *data) : store.readSpilled(id, scratch);
+                    if(!intact) corrupt[pool->workerIndex()].push_back(id);
+                    checked++;
+                }
+            });
+        }
+        pool->wait();
+
+        report.blocksChecked = checked;
+        for(auto &c : corrupt) report.corruptBlocks.insert(report.corruptBlocks.end(), c.begin(), c.end());
+        if(report.corruptBlocks.empty()) return report;
+
+        unordered_set<int> bad(report.corruptBlocks.begin(), report.corruptBlocks.end());
+        vector<pair<string, File*>> files;
+        collectFiles(root, "/", true, files);
+        for(auto &f : files) {
+            for(int id : f.second->blocks) {
+                if(bad.count(id)) {
+                    report.corruptFiles.push_back(f.first);
+                    break;
+                }
+            }
         }
+        sort(report.corruptFiles.begin(), report.corruptFiles.end());
+        return report;
+    }
+
+    MetricsSnapshot metrics() {
+        return stats.snapshot();
+    }
+
+    // Record operations slower than `thresholdNs`, keeping 1 in `sampleEvery`
+    void setSlowOpTracing(uint64_t thresholdNs, uint64_t sampleEvery = 1) {
+        OpTimer timer(stats, FS_SET_SLOW_OP_TRACING, noPath);
+        stats.setSlowOpTracing(thresholdNs, sampleEvery);
+    }
+
+    // Called under the filesystem lock, in order, for every change to the tree.
+    // With `snapshot`, the current tree is first replayed as mkdir/append
+    // records (and link records for extra hard links) so a fresh replica can start from it.
+    // Returns false, and drops the listener, if the snapshot can't be read in full.
+    bool setMutationListener(function<void(const LogRecord&)> listener, bool snapshot = false) {
+        OpTimer timer(stats, FS_SET_MUTATION_LISTENER, noPath);
+        lock_guard<recursive_mutex> lock(mtx);
+        mutationListener = listener;
+        if(!listener || !snapshot) return true;
+        unordered_map<File*, string> seen;
+        if(snapshotNode(root, "/", listener, seen)) return true;
+        mutationListener = nullptr;
+        return false;
+    }
+
+    // Apply many operations under one lock acquisition. Operations are sorted
+    // by path between rm barriers so neighbours share their prefix walk.
+    // With `atomic`, a failing operation rolls the whole batch back.
+    // Returns true if every operation succeeded.
+    bool applyBatch(vector<BatchOp> ops, bool atomic = false) {
+        OpTimer timer(stats, FS_BATCH, noPath);
+        vector<pair<vector<string>, size_t>> order;     // split path, op index
+        for(size_t i = 0; i < ops.size(); i++) order.push_back({split(ops[i].path), i});
+
+        // rm changes which paths exist, so never reorder across one
+        size_t start = 0;
+        for(size_t i = 0; i <= order.size(); i++) {
+            if(i == order.size() || ops[order[i].second].type == OP_RM) {
+                stable_sort(order.begin() + start, order.begin() + i,
+                            [](const pair<vector<string>, size_t> &a, const pair<vector<string>, size_t> &b) {
+                                return a.first < b.first;
+                            });
+                start = i + 1;
+            }
+        }
+
+        lock_guard<recursive_mutex> lock(mtx);
+
+        vector<FsEvent> events;
+        vector<LogRecord> log;
+        vector<UndoEntry> undo;
+        vector<Node*> removed;      // detached now, freed once the batch is final
+        PathCursor cursor;
+        cursor.dirs.push_back(root);
+        pendingEvents = &events;
+        pendingLog = &log;
+
+        bool ok = true;
+        for(auto &it : order) {
+            if(!applyOp(ops[it.second], it.first, cursor, atomic ? &undo : nullptr, removed)) {
+                ok = false;
+                if(atomic) break;
+            }
+        }
+        pendingEvents = nullptr;
+        pendingLog = nullptr;
+
+        if(!ok && atomic) {
+            rollback(undo);
+            return false;
+        }
+
+        for(Node* node : removed) Directory::release(node);
+        for(auto &rec : log) mutationListener(rec);
+        for(auto &ev : events) deliver(ev);
+        return ok;
     }
 };
 
-class FileSystem {
+
+
+size_t FileHandle::write(const string &data) {
+    if(file == nullptr || mode == MODE_READ) return 0;
+    OpTimer timer(fs->stats, FS_HANDLE_WRITE, fs->noPath);
+    buffer += data;
+    if(buffer.size() >= BUFFER_SIZE && !flush()) {
+        buffer.resize(buffer.size() - data.size());     // earlier writes stay buffered
+        return 0;
+    }
+    return data.size();
+}
+
+string FileHandle::read(size_t n) {
+    if(file == nullptr) return "";
+    OpTimer timer(fs->stats, FS_HANDLE_READ, fs->noPath);
+    flush();
+    lock_guard<recursive_mutex> lock(fs->mtx);
+    if(file == nullptr) return "";
+    string data;
+    if(!file->readRange(readOffset, n, data)) return "";
+    readOffset += data.size();
+    return data;
+}
+
+bool FileHandle::flush() {
+    if(file == nullptr) return buffer.empty();
+    OpTimer timer(fs->stats, FS_HANDLE_FLUSH, fs->noPath);
+    if(buffer.empty()) return true;
+    lock_guard<recursive_mutex> lock(fs->mtx);
+    if(file == nullptr) return false;   // filesystem went away while we were waiting
+    if(!fs->appendToFile(file, buffer)) return false;
+    buffer.clear();
+    return true;
+}
+
+bool FileHandle::close() {
+    if(file == nullptr) return buffer.empty();
+    OpTimer timer(fs->stats, FS_HANDLE_CLOSE, fs->noPath);
+    if(!flush()) return false;
+    release();
+    return true;
+}
+
+void FileHandle::release() {
+    if(fs == nullptr) return;
+    lock_guard<recursive_mutex> lock(fs->mtx);
+    fs->handles.erase(this);
+    if(file) fs->releaseHandle(file);
+    file = nullptr;
+    fs = nullptr;
+}
+
+// ---------------- SHARDED FILESYSTEM ----------------
+// Bounded single-producer/single-consumer ring
+template<typename T>
+class SpscQueue {
 private:
-    Directory* root;
+    vector<T> slots;
+    size_t mask;
+    alignas(64) atomic<size_t> head;    // next slot to pop, owned by the consumer
+    alignas(64) atomic<size_t> tail;    // next slot to push, owned by the producer
 
-    vector<string> split(string path) {
-        vector<string> tokens;
-        stringstream ss(path);
-        string token;
+public:
+    SpscQueue(size_t capacity) : head(0), tail(0) {
+        size_t size = 1;
+        while(size < capacity) size <<= 1;
+        slots.resize(size);
+        mask = size - 1;
+    }
 
-        while(getline(ss, token, '/')) {
-            if(!token.empty()) tokens.push_back(token);
-        }
-        return tokens;
+    bool tryPush(T &&value) {
+        size_t t = tail.load(memory_order_relaxed);
+        if(t - head.load(memory_order_acquire) == slots.size()) return false;
+        slots[t & mask] = move(value);
+        tail.store(t + 1, memory_order_release);
+        return true;
     }
 
-    // Helper to get parent directory and last node name
-    pair<Directory*, string> getParent(string path) {
-        vector<string> parts = split(path);
-        Directory* curr = root;
+    bool tryPop(T &value) {
+        size_t h = head.load(memory_order_relaxed);
+        if(h == tail.load(memory_order_acquire)) return false;
+        value = move(slots[h & mask]);
+        head.store(h + 1, memory_order_release);
+        return true;
+    }
 
-        for(int i = 0; i < parts.size() - 1; i++) {
-            if(!curr->hasChild(parts[i])) return {nullptr, ""};
-            curr = dynamic_cast<Directory*>(curr->getChild(parts[i]));
+    bool empty() {
+        return head.load(memory_order_acquire) == tail.load(memory_order_acquire);
+    }
+};
+
+// Shared-nothing mode: every top-level directory is owned by one worker
+// thread (chosen by hashing its name), which keeps its own FileSystem and is
+// the only thread that ever touches it. Operations are shipped to the owner
+// over its SPSC queue; callers on several threads take turns as the single
+// producer. An idle worker parks on a condition variable and the producer
+// only wakes it when it is asleep. mv across shards exports the subtree from the source, which
+// removes it in the same step, and imports it atomically on the destination,
+// restoring the source if the import fails.
+class ShardedFileSystem {
+private:
+    struct Shard {
+        FileSystem fs;
+        SpscQueue<function<void()>> queue;
+        mutex producerMtx;      // serializes producers, never taken by the worker
+        mutex sleepMtx;
+        condition_variable wake;
+        atomic<bool> sleeping{false};
+        thread worker;
+
+        Shard() : queue(1024) {}
+    };
+
+    vector<unique_ptr<Shard>> shards;
+    atomic<bool> stopping;
+
+    void runWorker(Shard* shard) {
+        while(true) {
+            function<void()> job;
+            if(shard->queue.tryPop(job)) {
+                job();
+                continue;
+            }
+            if(stopping) return;
+
+            // Announce the nap before the last look at the queue; the
+            // producer checks the flag after its push, so one of us sees the other
+            unique_lock<mutex> lock(shard->sleepMtx);
+            shard->sleeping.store(true, memory_order_relaxed);
+            atomic_thread_fence(memory_order_seq_cst);
+            shard->wake.wait(lock, [&] { return !shard->queue.empty() || stopping; });
+            shard->sleeping.store(false, memory_order_relaxed);
         }
+    }
 
-        return {curr, parts.back()};
+    static vector<string> split(const string &path) {
+        vector<string> parts;
+        stringstream ss(path);
+        string token;
+        while(getline(ss, token, '/')) {
+            if(!token.empty()) parts.push_back(token);
+        }
+        return parts;
     }
 
-    Node* traverse(string path) {
-        if(path == "/") return root;
+    static string normalize(const string &path) {
+        string out;
+        for(string &part : split(path)) out += "/" + part;
+        return out.empty() ? "/" : out;
+    }
 
-        Directory* curr = root;
+    // Owning shard of a path, -1 for the root itself
+    int shardOf(const string &path) {
         vector<string> parts = split(path);
+        if(parts.empty()) return -1;
+        return hash<string>()(parts[0]) % shards.size();
+    }
 
-        for(int i = 0; i < parts.size(); i++) {
-            if(!curr->hasChild(parts[i])) return nullptr;
+public:
+    ShardedFileSystem(size_t shardCount = 0) : stopping(false) {
+        if(shardCount == 0) shardCount = max(1u, thread::hardware_concurrency());
+        for(size_t i = 0; i < shardCount; i++) shards.emplace_back(new Shard());
+        for(auto &s : shards) s->worker = thread(&ShardedFileSystem::runWorker, this, s.get());
+    }
 
-            Node* next = curr->getChild(parts[i]);
+    ~ShardedFileSystem() {
+        stopping = true;
+        for(auto &s : shards) {
+            lock_guard<mutex> lock(s->sleepMtx);
+            s->wake.notify_one();
+        }
+        for(auto &s : shards) s->worker.join();
+    }
 
-            if(i == parts.size() - 1) return next;
+    // Run `f(fs)` on the worker owning `shard`. Must not be called from a worker.
+    template<typename F>
+    auto submit(size_t shard, F f) -> future<decltype(f(declval<FileSystem&>()))> {
+        using R = decltype(f(declval<FileSystem&>()));
+        Shard* s = shards[shard].get();
+        auto task = make_shared<packaged_task<R()>>([s, f]() mutable { return f(s->fs); });
+        future<R> result = task->get_future();
 
-            curr = dynamic_cast<Directory*>(next);
+        function<void()> job = [task] { (*task)(); };
+        {
+            lock_guard<mutex> lock(s->producerMtx);
+            while(!s->queue.tryPush(move(job))) this_thread::yield();
         }
+        atomic_thread_fence(memory_order_seq_cst);
+        if(s->sleeping.load(memory_order_relaxed)) {
+            lock_guard<mutex> lock(s->sleepMtx);
+            s->wake.notify_one();
+        }
+        return result;
+    }
 
-        return curr;
+    void mkdir(string path) {
+        int shard = shardOf(path);
+        if(shard < 0) return;
+        submit(shard, [path](FileSystem &fs) { fs.mkdir(path); }).get();
     }
 
-public:
-    FileSystem() {
-        root = new Directory("/");
+    void addContentToFile(string filePath, string content) {
+        int shard = shardOf(filePath);
+        if(shard < 0) return;
+        submit(shard, [filePath, content](FileSystem &fs) { fs.addContentToFile(filePath, content); }).get();
+    }
+
+    string readContentFromFile(string filePath) {
+        int shard = shardOf(filePath);
+        if(shard < 0) return "";
+        return submit(shard, [filePath](FileSystem &fs) { return fs.readContentFromFile(filePath); }).get();
     }
 
     vector<string> ls(string path) {
-        Node* node = traverse(path);
+        int shard = shardOf(path);
+        if(shard >= 0) {
+            return submit(shard, [path](FileSystem &fs) { return fs.ls(path); }).get();
+        }
+
+        // The root is spread over every shard
+        vector<future<vector<string>>> parts;
+        for(size_t i = 0; i < shards.size(); i++) {
+            parts.push_back(submit(i, [](FileSystem &fs) { return fs.ls("/"); }));
+        }
         vector<string> result;
+        for(auto &p : parts) {
+            vector<string> names = p.get();
+            result.insert(result.end(), names.begin(), names.end());
+        }
+        sort(result.begin(), result.end());
+        return result;
+    }
 
-        if(node == nullptr) return result;
+    void rm(string path) {
+        int shard = shardOf(path);
+        if(shard < 0) return;
+        submit(shard, [path](FileSystem &fs) { fs.rm(path); }).get();
+    }
 
-        if(node->isFile) {
-            result.push_back(node->name);
-            return result;
+    size_t du(string path) {
+        int shard = shardOf(path);
+        if(shard >= 0) return submit(shard, [path](FileSystem &fs) { return fs.du(path); }).get();
+
+        size_t total = 0;
+        for(size_t i = 0; i < shards.size(); i++) {
+            total += submit(i, [](FileSystem &fs) { return fs.du("/"); }).get();
         }
+        return total;
+    }
 
-        Directory* dir = dynamic_cast<Directory*>(node);
+    void mv(string src, string dst) {
+        int from = shardOf(src);
+        int to = shardOf(dst);
+        if(from < 0 || to < 0) {
+            cout << "Invalid path\n";
+            return;
+        }
+        if(from == to) {
+            submit(from, [src, dst](FileSystem &fs) { fs.mv(src, dst); }).get();
+            return;
+        }
 
-        for(auto &it : dir->children) {
-            result.push_back(it.first);
+        string srcPath = normalize(src);
+        string dstPath = normalize(dst);
+        string dstParent = dstPath.substr(0, dstPath.rfind('/'));
+        if(dstParent.empty()) dstParent = "/";
+
+        // 1. Destination must be free and its parent must exist
+        bool ready = submit(to, [dstPath, dstParent](FileSystem &fs) {
+            return !fs.exists(dstPath) && (dstParent == "/" || fs.exists(dstParent));
+        }).get();
+        if(!ready) {
+            cout << "Invalid destination\n";
+            return;
         }
 
-        sort(result.begin(), result.end());
-        return result;
+        // 2. Export and remove in one step on the source shard. A hard link
+        //    can't span shards, so subtrees holding multi-link files stay put.
+        auto [linked, ops] = submit(from, [srcPath](FileSystem &fs) {
+            vector<BatchOp> tree = fs.exportTree(srcPath);
+            vector<string> files;
+            for(BatchOp &op : tree) {
+                if(op.type == OP_APPEND) files.push_back(op.path);
+            }
+            for(FileStat &st : fs.statMany(files)) {
+                if(st.linkCount > 1) return make_pair(true, vector<BatchOp>());
+            }
+            if(!tree.empty()) fs.rm(srcPath);
+            return make_pair(false, tree);
+        }).get();
+        if(linked) {
+            cout << "Cannot move hard-linked files across shards\n";
+            return;
+        }
+        if(ops.empty()) {
+            cout << "Invalid path\n";
+            return;
+        }
+
+        // 3. Import atomically on the destination, or put the source back
+        vector<BatchOp> moved = ops;
+        for(BatchOp &op : moved) op.path = dstPath + op.path.substr(srcPath.size());
+        bool ok = submit(to, [moved](FileSystem &fs) {
+            return !fs.exists(moved[0].path) && fs.applyBatch(moved, true);
+        }).get();
+        if(!ok) {
+            bool restored = submit(from, [ops](FileSystem &fs) { return fs.applyBatch(ops, true); }).get();
+            cout << (restored ? "Move failed, source restored\n" : "Move failed, source could not be restored\n");
+        }
     }
+};
 
-    void mkdir(string path) {
-        Directory* curr = root;
-        vector<string> parts = split(path);
+// ---------------- REPLICATION ----------------
+// The primary ships its mutation log to a follower over a Unix domain socket.
+// Frames are [u32 length][records], each record [u8 op][u32 n][path][u32 n][arg].
+static void putU32(string &out, uint32_t v) {
+    out.append((const char*)&v, 4);
+}
 
-        for(string &part : parts) {
-            if(!curr->hasChild(part)) {
-                curr->addChild(part, new Directory(part));
+static bool writeAll(int fd, const char* data, size_t n) {
+    while(n > 0) {
+        ssize_t w = send(fd, data, n, MSG_NOSIGNAL);
+        if(w < 0 && errno == EINTR) continue;
+        if(w <= 0) return false;
+        data += w;
+        n -= w;
+    }
+    return true;
+}
+
+static bool readAll(int fd, char* data, size_t n) {
+    while(n > 0) {
+        ssize_t r = recv(fd, data, n, 0);
+        if(r < 0 && errno == EINTR) continue;
+        if(r <= 0) return false;
+        data += r;
+        n -= r;
+    }
+    return true;
+}
+
+static bool socketAddress(const string &path, sockaddr_un &addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(addr.sun_path)) return false;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+class ReplicationPrimary {
+private:
+    FileSystem &fs;
+    int sock;
+    mutex mtx;
+    condition_variable changed;
+    vector<LogRecord> queue;        // logged but not yet shipped
+    uint64_t logged = 0;
+    uint64_t shipped = 0;
+    bool stopping = false;
+    bool broken = false;
+    thread shipper;
+
+    void enqueue(const LogRecord &rec) {
+        lock_guard<mutex> lock(mtx);
+        if(broken) return;
+        queue.push_back(rec);
+        logged++;
+        changed.notify_all();
+    }
+
+    // Everything queued since the last wakeup goes out as one frame
+    void run() {
+        unique_lock<mutex> lock(mtx);
+        while(true) {
+            changed.wait(lock, [&] { return stopping || !queue.empty(); });
+            if(queue.empty()) return;
+
+            vector<LogRecord> batch;
+            batch.swap(queue);
+            lock.unlock();
+
+            string frame(4, '\0');
+            for(auto &rec : batch) {
+                frame.push_back((char)rec.op);
+                putU32(frame, rec.path.size());
+                frame += rec.path;
+                putU32(frame, rec.arg.size());
+                frame += rec.arg;
+            }
+            uint32_t len = frame.size() - 4;
+            memcpy(&frame[0], &len, 4);
+            bool ok = writeAll(sock, frame.data(), frame.size());
+
+            lock.lock();
+            if(!ok) {
+                cout << "Replication: follower went away\n";
+                broken = true;
+                queue.clear();
+                logged = shipped;
+            } else {
+                shipped += batch.size();
             }
-            curr = dynamic_cast<Directory*>(curr->getChild(part));
+            changed.notify_all();
         }
     }
 
-    void addContentToFile(string filePath, string content) {
-        Directory* curr = root;
-        vector<string> parts = split(filePath);
+public:
+    // Connect to a follower listening on `socketPath` and start shipping,
+    // beginning with a snapshot of the current tree
+    ReplicationPrimary(FileSystem &fs, const string &socketPath) : fs(fs) {
+        sockaddr_un addr;
+        sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(sock < 0 || !socketAddress(socketPath, addr) ||
+           connect(sock, (sockaddr*)&addr, sizeof(addr)) < 0) {
+            cout << "Replication: cannot connect to " << socketPath << "\n";
+            broken = true;
+            return;
+        }
+        shipper = thread(&ReplicationPrimary::run, this);
+        if(!fs.setMutationListener([this](const LogRecord &rec) { enqueue(rec); }, true)) {
+            cout << "Replication: snapshot failed\n";
+            lock_guard<mutex> lock(mtx);
+            broken = true;
+            queue.clear();
+            logged = shipped;
+            changed.notify_all();
+        }
+    }
 
-        for(int i = 0; i < parts.size(); i++) {
-            string part = parts[i];
+    ~ReplicationPrimary() {
+        if(shipper.joinable()) {
+            fs.setMutationListener(nullptr);
+            {
+                lock_guard<mutex> lock(mtx);
+                stopping = true;
+                changed.notify_all();
+            }
+            shipper.join();
+        }
+        if(sock >= 0) close(sock);
+    }
 
-            if(i == parts.size() - 1) {
-                if(!curr->hasChild(part)) {
-                    curr->addChild(part, new File(part));
-                }
+    // Block until everything logged so far has been written to the socket
+    void flush() {
+        unique_lock<mutex> lock(mtx);
+        changed.wait(lock, [&] { return shipped == logged; });
+    }
 
-                File* file = dynamic_cast<File*>(curr->getChild(part));
-                file->appendContent(content);
-            } else {
-                if(!curr->hasChild(part)) {
-                    curr->addChild(part, new Directory(part));
-                }
-                curr = dynamic_cast<Directory*>(curr->getChild(part));
+    uint64_t shippedRecords() {
+        lock_guard<mutex> lock(mtx);
+        return shipped;
+    }
+};
+
+// Applies a primary's log to its own tree and serves reads from it
+class ReplicationFollower {
+private:
+    FileSystem fs;
+    string socketPath;
+    int listenFd;
+    atomic<int> connFd;
+    atomic<bool> stopping;
+    mutex mtx;
+    condition_variable progress;
+    uint64_t applied = 0;
+    thread receiver;
+
+    void apply(const LogRecord &rec) {
+        switch(rec.op) {
+            case LOG_MKDIR: fs.mkdir(rec.path); break;
+            case LOG_APPEND: fs.addContentToFile(rec.path, rec.arg); break;
+            case LOG_RM: fs.rm(rec.path); break;
+            case LOG_MV: fs.mv(rec.path, rec.arg); break;
+            case LOG_LINK: fs.link(rec.path, rec.arg); break;
+            case LOG_TRUNCATE: {
+                unique_ptr<FileHandle> h = fs.open(rec.path, MODE_WRITE);
+                if(h) h->close();
+                break;
             }
         }
     }
 
-    string readContentFromFile(string filePath) {
-        Node* node = traverse(filePath);
-        if(node && node->isFile) {
-            File* file = dynamic_cast<File*>(node);
-            return file->getContent();
+    bool decode(const string &frame, vector<LogRecord> &records) {
+        size_t pos = 0;
+        auto getU32 = [&](uint32_t &v) {
+            if(frame.size() - pos < 4) return false;
+            memcpy(&v, frame.data() + pos, 4);
+            pos += 4;
+            return true;
+        };
+        while(pos < frame.size()) {
+            LogRecord rec;
+            uint32_t n;
+            rec.op = (LogOp)(unsigned char)frame[pos++];
+            if(rec.op > LOG_TRUNCATE || !getU32(n) || frame.size() - pos < n) return false;
+            rec.path = frame.substr(pos, n);
+            pos += n;
+            if(!getU32(n) || frame.size() - pos < n) return false;
+            rec.arg = frame.substr(pos, n);
+            pos += n;
+            records.push_back(move(rec));
         }
-        return "";
+        return true;
     }
 
-    // ✅ NEW DELETE API
-    void rm(string path) {
-        auto [parent, name] = getParent(path);
+    // One primary at a time; a new one may connect after the old one leaves
+    void run() {
+        while(!stopping) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if(fd < 0) {
+                if(errno == EINTR) continue;
+                return;
+            }
+            connFd = fd;
+            if(stopping) {
+                close(fd);
+                return;
+            }
 
-        if(parent == nullptr) {
-            cout << "Invalid path\n";
-            return;
+            uint32_t len;
+            string frame;
+            while(readAll(fd, (char*)&len, 4)) {
+                frame.resize(len);
+                if(!readAll(fd, &frame[0], len)) break;
+
+                vector<LogRecord> records;
+                if(!decode(frame, records)) {
+                    cout << "Replication: corrupt frame\n";
+                    break;
+                }
+                for(auto &rec : records) apply(rec);
+
+                lock_guard<mutex> lock(mtx);
+                applied += records.size();
+                progress.notify_all();
+            }
+            connFd = -1;
+            close(fd);
         }
+    }
 
-        if(!parent->hasChild(name)) {
-            cout << "File/Directory not found\n";
+public:
+    ReplicationFollower(const string &socketPath) : socketPath(socketPath), connFd(-1), stopping(false) {
+        sockaddr_un addr;
+        listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(listenFd < 0 || !socketAddress(socketPath, addr)) {
+            cout << "Replication: cannot listen on " << socketPath << "\n";
             return;
         }
+        unlink(socketPath.c_str());
+        if(bind(listenFd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listenFd, 1) < 0) {
+            cout << "Replication: cannot listen on " << socketPath << "\n";
+            return;
+        }
+        receiver = thread(&ReplicationFollower::run, this);
+    }
 
-        parent->removeChild(name);
+    ~ReplicationFollower() {
+        stopping = true;
+        if(listenFd >= 0) shutdown(listenFd, SHUT_RDWR);     // wakes accept()
+        int fd = connFd;
+        if(fd >= 0) shutdown(fd, SHUT_RDWR);                 // wakes recv()
+        if(receiver.joinable()) {
+            receiver.join();
+            unlink(socketPath.c_str());
+        }
+        if(listenFd >= 0) close(listenFd);
+    }
+
+    vector<string> ls(string path) {
+        return fs.ls(path);
     }
-};
 
+    string readContentFromFile(string filePath) {
+        return fs.readContentFromFile(filePath);
+    }
 
+    uint64_t appliedRecords() {
+        lock_guard<mutex> lock(mtx);
+        return applied;
+    }
 
+    // Wait until at least `n` records have been applied; false on timeout
+    bool waitForRecords(uint64_t n, chrono::milliseconds timeout = chrono::seconds(5)) {
+        unique_lock<mutex> lock(mtx);
+        return progress.wait_for(lock, timeout, [&] { return applied >= n; });
+    }
+};
 
+// Define FS_NO_MAIN to reuse this file from another program (see the benchmark)
+#ifndef FS_NO_MAIN
 int main() {
     FileSystem fs;
+    int watchId = fs.watch("/a", true);
 
     fs.mkdir("/a/b/c");
     fs.addContentToFile("/a/b/c/file.txt", "Hello World");
@@ -208,6 +3498,105 @@ int main() {
 
     vector<string> files = fs.ls("/a/b/c");
     for(auto &f : files) cout << f << " ";
+    cout << endl;
+
+    string tmpl(3 * BLOCK_SIZE, 'x');
+    fs.addContentToFile("/site/a/index.html", tmpl);
+    fs.addContentToFile("/site/b/index.html", tmpl);
+    DedupStats ds = fs.dedupStats();
+    cout << "Dedup ratio: " << ds.ratio << " (" << ds.uniqueBlocks << " unique blocks)" << endl;
+
+    cout << "du /site: " << fs.du("/site") << endl;
+    fs.setQuota("/site/a", 4 * BLOCK_SIZE);
+    fs.addContentToFile("/site/a/big.bin", tmpl);   // exceeds the quota
+
+    fs.addContentToFile("/a/log.txt", "1");
+    fs.addContentToFile("/a/log.txt", "2");         // coalesced with the previous modify
+    fs.mv("/a/log.txt", "/a/b/log.txt");
+    unique_ptr<FileHandle> out = fs.open("/a/b/events.log", MODE_APPEND);
+    for(int i = 0; i < 1000; i++) out->write("event " + to_string(i) + "\n");
+    out->close();
+    unique_ptr<FileHandle> in = fs.open("/a/b/events.log", MODE_READ);
+    cout << "First read: " << in->read(8);
+
+    vector<BatchOp> ops = {
+        {OP_APPEND, "/ingest/job1/part-00001", "rows"},
+        {OP_MKDIR, "/ingest/job1/tmp", ""},
+        {OP_APPEND, "/ingest/job1/part-00000", "rows"},
+    };
+    fs.applyBatch(ops, true);
+    ops.push_back({OP_RM, "/ingest/missing", ""});
+    ops.push_back({OP_APPEND, "/ingest/job2/part-00000", "rows"});
+    cout << "Atomic batch with a bad rm applied: " << fs.applyBatch(ops, true)
+         << ", /ingest has " << fs.ls("/ingest").size() << " entries" << endl;
+
+    fs.setMemoryBudget(2 * BLOCK_SIZE);
+    for(int i = 0; i < 8; i++) fs.addContentToFile("/cold/f" + to_string(i), string(BLOCK_SIZE, 'a' + i));
+    fs.setMemoryBudget(2 * BLOCK_SIZE);                     // let the background spill writes land
+    string page = fs.readContentFromFile("/cold/f0");      // faulted back in from disk
+    TierStats ts = fs.tierStats();
+    cout << "Cold read ok: " << (page == string(BLOCK_SIZE, 'a')) << ", resident " << ts.residentBytes
+         << ", spilled " << ts.spilledBytes << ", page-ins " << ts.pageIns << endl;
+
+    for(auto &path : fs.glob("/cold/f[0-3]")) cout << path << " ";
+    cout << endl;
+    for(auto &m : fs.grep("/a", "event 99", true)) {
+        cout << m.path << ": " << m.offsets.size() << " matches" << endl;
+    }
+    atomic<int> nodes(0);
+    fs.walk("/", [&](const string &, bool) { nodes++; });
+    cout << "Walked " << nodes << " nodes" << endl;
+
+    MetricsSnapshot ms = fs.metrics();
+    for(int op : {FS_APPEND, FS_READ, FS_LS}) {
+        cout << FS_OP_NAMES[op] << ": " << ms.ops[op].count << " calls, p99 " << ms.ops[op].p99Ns << " ns" << endl;
+    }
+
+    ShardedFileSystem sharded(4);
+    sharded.addContentToFile("/tenant1/app/config.json", "{}");
+    sharded.addContentToFile("/tenant2/app/config.json", "{\"v\": 2}");
+    sharded.mv("/tenant2/app", "/tenant1/app2");
+    cout << "Sharded root: " << sharded.ls("/").size() << " tenants, moved file: "
+         << sharded.readContentFromFile("/tenant1/app2/config.json") << endl;
+
+    fs.mkdir("/site/c");
+    fs.link("/site/a/index.html", "/site/c/index.html");   // no content copy
+    fs.rm("/site/a/index.html");
+    cout << "Linked copy survives rm: " << (fs.readContentFromFile("/site/c/index.html") == tmpl) << endl;
+    fs.link("/site/c/index.html", "/site/c/index.html/x/y");  // a file has no children: Invalid path
+
+    fs.setVerifyChecksums(true);
+    ScrubReport scrubbed = fs.scrub();
+    cout << "Scrubbed " << scrubbed.blocksChecked << " blocks, " << scrubbed.corruptBlocks.size() << " corrupt" << endl;
+
+    FileStat st = fs.stat("/site/c/index.html");
+    vector<FileStat> many = fs.statMany({"/site/a", "/site/b", "/site/c", "/site/missing"});
+    cout << "stat index.html: " << st.size << " bytes, " << st.linkCount << " link(s); /site/b has "
+         << many[1].childCount << " entries, missing exists: " << many[3].exists << endl;
+
+    for(int i = 0; i < 200; i++) fs.addContentToFile("/churn/f" + to_string(i), string(BLOCK_SIZE, (char)i));
+    for(int i = 0; i < 195; i++) fs.rm("/churn/f" + to_string(i));
+    size_t heapBefore = fs.memoryUsage().totalBytes;
+    size_t reclaimed = fs.compact();
+    cout << "Compaction reclaimed " << reclaimed << " of " << heapBefore << " bytes" << endl;
+
+    string socketPath = "/tmp/fs-replica-" + to_string(getpid()) + ".sock";
+    ReplicationFollower follower(socketPath);
+    {
+        ReplicationPrimary primary(fs, socketPath);
+        fs.addContentToFile("/site/c/about.html", "<h1>about</h1>");
+        fs.mv("/site/c/about.html", "/site/b/about.html");
+        primary.flush();
+        follower.waitForRecords(primary.shippedRecords());
+    }
+    cout << "Follower sees: " << follower.readContentFromFile("/site/b/about.html")
+         << ", /site/c has " << follower.ls("/site/c").size() << " entries" << endl;
+
+    const char* kinds[] = {"CREATE", "MODIFY", "DELETE", "MOVE", "OVERFLOW"};
+    for(auto &ev : fs.poll(watchId)) {
+        cout << kinds[ev.type] << " " << ev.path << (ev.toPath.empty() ? "" : " -> " + ev.toPath) << endl;
+    }
 
     return 0;
 }
+#endif
@@ -0,0 +1,216 @@
+/*
+    mdtest-style metadata benchmark for the in-memory FileSystem.
+
+    Every thread builds its own tree under /t<i> (fan-out x depth directories,
+    files in the leaf directories) and runs the phases mkdir, create, append,
+    read, ls and rm. Each phase is timed across all threads together, and the
+    program prints one JSON object per (threads, phase) on stdout.
+
+    Build: g++ -std=c++17 -O2 -pthread In_Memory_File_System_Benchmark.cpp -o fs_bench
+    Usage: fs_bench [--fanout N] [--depth N] [--files N] [--threads N]
+                    [--size-dist fixed|uniform|exp] [--file-size BYTES]
+                    [--appends N] [--seed N]
+*/
+#define FS_NO_MAIN
+#include "In_Memory_File_System_Amazon.cpp"
+
+struct BenchConfig {
+    int fanout = 4;
+    int depth = 3;
+    int filesPerDir = 16;
+    int maxThreads = 1;
+    string sizeDist = "fixed";
+    size_t fileSize = 1024;
+    int appends = 4;
+    unsigned seed = 42;
+};
+
+struct PhaseResult {
+    size_t ops;
+    double seconds;
+    vector<uint64_t> latencyNs;
+};
+
+class Benchmark {
+private:
+    BenchConfig cfg;
+
+    // Leaf directories of one thread's tree, depth-first
+    void leafDirs(string prefix, int level, vector<string> &dirs, vector<string> &leaves) {
+        dirs.push_back(prefix);
+        if(level == cfg.depth) {
+            leaves.push_back(prefix);
+            return;
+        }
+        for(int i = 0; i < cfg.fanout; i++) {
+            leafDirs(prefix + "/d" + to_string(i), level + 1, dirs, leaves);
+        }
+    }
+
+    size_t nextSize(mt19937_64 &rng) {
+        if(cfg.sizeDist == "uniform") {
+            return uniform_int_distribution<size_t>(0, 2 * cfg.fileSize)(rng);
+        }
+        if(cfg.sizeDist == "exp") {
+            return (size_t)exponential_distribution<double>(1.0 / max<size_t>(cfg.fileSize, 1))(rng);
+        }
+        return cfg.fileSize;
+    }
+
+    static uint64_t percentile(vector<uint64_t> &sorted, double p) {
+        if(sorted.empty()) return 0;
+        size_t i = min(sorted.size() - 1, (size_t)(p * sorted.size()));
+        return sorted[i];
+    }
+
+    // Run `work(threadIndex, latencies)` on `threads` threads and time the phase
+    PhaseResult runPhase(int threads, function<void(int, vector<uint64_t>&)> work) {
+        vector<vector<uint64_t>> latencies(threads);
+        vector<thread> workers;
+
+        auto start = chrono::steady_clock::now();
+        for(int t = 0; t < threads; t++) {
+            workers.emplace_back([&, t] { work(t, latencies[t]); });
+        }
+        for(thread &w : workers) w.join();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        PhaseResult result = {0, seconds, {}};
+        for(auto &l : latencies) result.latencyNs.insert(result.latencyNs.end(), l.begin(), l.end());
+        result.ops = result.latencyNs.size();
+        return result;
+    }
+
+    template<typename F>
+    static void timed(vector<uint64_t> &latencies, F op) {
+        auto start = chrono::steady_clock::now();
+        op();
+        latencies.push_back(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+    }
+
+    void report(int threads, const string &phase, PhaseResult &r) {
+        sort(r.latencyNs.begin(), r.latencyNs.end());
+        double opsPerSec = r.seconds > 0 ? r.ops / r.seconds : 0;
+        printf("{\"threads\": %d, \"phase\": \"%s\", \"ops\": %zu, \"seconds\": %.6f, \"ops_per_sec\": %.1f, "
+               "\"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu}\n",
+               threads, phase.c_str(), r.ops, r.seconds, opsPerSec,
+               (unsigned long long)percentile(r.latencyNs, 0.50),
+               (unsigned long long)percentile(r.latencyNs, 0.90),
+               (unsigned long long)percentile(r.latencyNs, 0.99),
+               (unsigned long long)(r.latencyNs.empty() ? 0 : r.latencyNs.back()));
+    }
+
+public:
+    Benchmark(BenchConfig cfg) : cfg(cfg) {}
+
+    void run(int threads) {
+        FileSystem fs;
+        vector<vector<string>> dirs(threads), leaves(threads), files(threads);
+        vector<vector<string>> payloads(threads);
+
+        for(int t = 0; t < threads; t++) {
+            leafDirs("/t" + to_string(t), 0, dirs[t], leaves[t]);
+            mt19937_64 rng(cfg.seed + t);
+            for(string &leaf : leaves[t]) {
+                for(int f = 0; f < cfg.filesPerDir; f++) {
+                    files[t].push_back(leaf + "/f" + to_string(f));
+                    payloads[t].push_back(string(nextSize(rng), 'a' + f % 26));
+                }
+            }
+        }
+
+        PhaseResult r = runPhase(threads, [&](int t, vector<uint64_t> &lat) {
+            for(string &d : dirs[t]) timed(lat, [&] { fs.mkdir(d); });
+        });
+        report(threads, "mkdir", r);
+
+        r = runPhase(threads, [&](int t, vector<uint64_t> &lat) {
+            for(size_t i = 0; i < files[t].size(); i++) {
+                timed(lat, [&] { fs.addContentToFile(files[t][i], payloads[t][i]); });
+            }
+        });
+        report(threads, "create", r);
+
+        r = runPhase(threads, [&](int t, vector<uint64_t> &lat) {
+            for(int a = 0; a < cfg.appends; a++) {
+                for(size_t i = 0; i < files[t].size(); i++) {
+                    timed(lat, [&] { fs.addContentToFile(files[t][i], payloads[t][i]); });
+                }
+            }
+        });
+        report(threads, "append", r);
+
+        r = runPhase(threads, [&](int t, vector<uint64_t> &lat) {
+            for(string &f : files[t]) timed(lat, [&] { fs.readContentFromFile(f); });
+        });
+        report(threads, "read", r);
+
+        r = runPhase(threads, [&](int t, vector<uint64_t> &lat) {
+            for(string &d : dirs[t]) timed(lat, [&] { fs.ls(d); });
+        });
+        report(threads, "ls", r);
+
+        r = runPhase(threads, [&](int t, vector<uint64_t> &lat) {
+            for(string &f : files[t]) timed(lat, [&] { fs.rm(f); });
+        });
+        report(threads, "rm", r);
+    }
+};
+
+static int usage() {
+    cerr << "Usage: fs_bench [--fanout N] [--depth N] [--files N] [--threads N]\n"
+            "                [--size-dist fixed|uniform|exp] [--file-size BYTES]\n"
+            "                [--appends N] [--seed N]\n";
+    return 1;
+}
+
+// Whole decimal numbers only, so "abc", "-1" and "4x" are rejected
+template<class T>
+static bool parseNumber(const string &text, T &out) {
+    if(text.empty() || !isdigit((unsigned char)text[0])) return false;
+    errno = 0;
+    char* end;
+    unsigned long long n = strtoull(text.c_str(), &end, 10);
+    if(errno != 0 || *end != '\0' || n > (unsigned long long)numeric_limits<T>::max()) return false;
+    out = (T)n;
+    return true;
+}
+
+int main(int argc, char** argv) {
+    BenchConfig cfg;
+
+    for(int i = 1; i < argc; i += 2) {
+        string flag = argv[i];
+        if(i + 1 == argc) {
+            cerr << "Missing value for " << flag << "\n";
+            return usage();
+        }
+        string value = argv[i + 1];
+        bool ok = true;
+        if(flag == "--fanout") ok = parseNumber(value, cfg.fanout);
+        else if(flag == "--depth") ok = parseNumber(value, cfg.depth);
+        else if(flag == "--files") ok = parseNumber(value, cfg.filesPerDir);
+        else if(flag == "--threads") ok = parseNumber(value, cfg.maxThreads);
+        else if(flag == "--size-dist") {
+            ok = value == "fixed" || value == "uniform" || value == "exp";
+            cfg.sizeDist = value;
+        }
+        else if(flag == "--file-size") ok = parseNumber(value, cfg.fileSize);
+        else if(flag == "--appends") ok = parseNumber(value, cfg.appends);
+        else if(flag == "--seed") ok = parseNumber(value, cfg.seed);
+        else {
+            cerr << "Unknown flag " << flag << "\n";
+            return usage();
+        }
+        if(!ok) {
+            cerr << "Bad value for " << flag << ": " << value << "\n";
+            return usage();
+        }
+    }
+
+    Benchmark bench(cfg);
+    for(int threads = 1; threads <= cfg.maxThreads; threads++) {
+        bench.run(threads);
+    }
+    return 0;
+}
@@ -7,9 +7,31 @@
 #include<vector>
 #include<memory>
 #include<string>
+#include<string_view>
+#include<cstdint>
+#include<functional>
+#include<deque>
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include<atomic>
+#include<unordered_map>
+#include<algorithm>
+#include<fcntl.h>
+#include<unistd.h>
+#include<dirent.h>
+#include<sys/stat.h>
+#include<sys/syscall.h>
 
 using namespace std;
 
+// What a filter looks at, independent of how the tree is stored
+struct FileInfo {
+    string_view name;
+    size_t size;
+    bool directory;
+};
+
 class File {
     private:
         string name;
@@ -34,15 +56,93 @@ class File {
         bool isDirectory() {
             return directory;
         }
-        vector<shared_ptr<File>> getChildren() {
+        const vector<shared_ptr<File>>& getChildren() {
             return children;
         }
+        FileInfo info() {
+            return {name, size, directory};
+        }
+};
+
+// The same tree flattened into parallel arrays in DFS order, so a full scan
+// is a linear pass over contiguous memory. Node 0 is the root; a node's
+// descendants directly follow it.
+class ColumnarTree {
+    private:
+        static const uint8_t FLAG_DIRECTORY = 1;
+        
+        string names;                   // all names back to back
+        vector<uint32_t> nameOffsets;   // name i is names[nameOffsets[i], nameOffsets[i + 1])
+        vector<size_t> sizes;
+        vector<uint8_t> flags;
+        vector<int32_t> firstChild;     // -1 if none
+        vector<int32_t> nextSibling;    // -1 if none
+        
+        int add(const shared_ptr<File> &file) {
+            int index = sizes.size();
+            nameOffsets.push_back(names.size());
+            names += file->getName();
+            sizes.push_back(file->getSize());
+            flags.push_back(file->isDirectory() ? FLAG_DIRECTORY : 0);
+            firstChild.push_back(-1);
+            nextSibling.push_back(-1);
+            
+            int prev = -1;
+            for(auto &child: file->getChildren()) {
+                int c = add(child);
+                if(prev < 0) {
+                    firstChild[index] = c;
+                } else {
+                    nextSibling[prev] = c;
+                }
+                prev = c;
+            }
+            return index;
+        }
+    public:
+        ColumnarTree(shared_ptr<File> root) {
+            if(root) {
+                add(root);
+            }
+            nameOffsets.push_back(names.size());
+        }
+        
+        int size() const {
+            return sizes.size();
+        }
+        string_view getName(int i) const {
+            return string_view(names).substr(nameOffsets[i], nameOffsets[i + 1] - nameOffsets[i]);
+        }
+        size_t getSize(int i) const {
+            return sizes[i];
+        }
+        bool isDirectory(int i) const {
+            return flags[i] & FLAG_DIRECTORY;
+        }
+        int getFirstChild(int i) const {
+            return firstChild[i];
+        }
+        int getNextSibling(int i) const {
+            return nextSibling[i];
+        }
+        FileInfo info(int i) const {
+            return {getName(i), sizes[i], isDirectory(i)};
+        }
 };
 
 class Filter {
     public:
         virtual ~Filter() = default;
-        virtual bool apply(shared_ptr<File> file) = 0;
+        virtual bool matches(const FileInfo &file) = 0;
+        
+        // Whether matches() reads FileInfo::size; crawlers only stat when it does
+        virtual bool needsSize() {
+            return false;
+        }
+        
+        virtual bool apply(shared_ptr<File> file) {
+            return matches(file->info());
+        }
 };
 
 class NameFilter : public Filter {
@@ -51,8 +151,11 @@ class NameFilter : public Filter {
     public:
         NameFilter(string name) : name(name) {}
         
-        bool apply(shared_ptr<File> file) {
-            return file->getName() == name;
+        const string& getName() {
+            return name;
+        }
+        bool matches(const FileInfo &file) {
+            return file.name == name;
         }
 };
 
@@ -62,12 +165,15 @@ class ExtensionFilter : public Filter {
     public:
         ExtensionFilter(string ext) : extension(ext) {}
         
-        bool apply(shared_ptr<File> file) {
-            if(file->isDirectory()) {
+        const string& getExtension() {
+            return extension;
+        }
+        bool matches(const FileInfo &file) {
+            if(file.directory) {
                 return false;
             }
             
-            string fileName = file->getName();
+            string_view fileName = file.name;
             if(fileName.length() < extension.length()) {
                 return false;
             }
@@ -82,8 +188,14 @@ class SizeGreaterFilter : public Filter {
     public:
         SizeGreaterFilter(size_t size) : minSize(size) {}
         
-        bool apply(shared_ptr<File> file) {
-            return file->getSize() > minSize;
+        size_t getMinSize() {
+            return minSize;
+        }
+        bool matches(const FileInfo &file) {
+            return file.size > minSize;
+        }
+        bool needsSize() {
+            return true;
         }
 };
 
@@ -93,8 +205,11 @@ class TypeFilter : public Filter {
     public:
         TypeFilter(bool isDirectory) : directory(isDirectory) {}
         
-        bool apply(shared_ptr<File> file) {
-            return file->isDirectory() == directory;
+        bool isDirectory() {
+            return directory;
+        }
+        bool matches(const FileInfo &file) {
+            return file.directory == directory;
         }
 };
 
@@ -104,14 +219,25 @@ class AndFilter : public Filter {
     public:
         AndFilter(vector<shared_ptr<Filter>> filters) : filters(filters) {}
         
-        bool apply(shared_ptr<File> file) {
+        const vector<shared_ptr<Filter>>& getFilters() {
+            return filters;
+        }
+        bool matches(const FileInfo &file) {
             for(auto &f: filters) {
-                if(!f->apply(file)) {
+                if(!f->matches(file)) {
                     return false;
                 }
             }
             return true;
         }
+        bool needsSize() {
+            for(auto &f: filters) {
+                if(f->needsSize()) {
+                    return true;
+                }
+            }
+            return false;
+        }
  };
  
  class OrFilter : public Filter {
@@ -120,9 +246,20 @@ class AndFilter : public Filter {
     public:
         OrFilter(vector<shared_ptr<Filter>> filters) : filters(filters) {}
         
-        bool apply(shared_ptr<File> file) {
+        const vector<shared_ptr<Filter>>& getFilters() {
+            return filters;
+        }
+        bool matches(const FileInfo &file) {
+            for(auto &f: filters) {
+                if(f->matches(file)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        bool needsSize() {
             for(auto &f: filters) {
-                if(f->apply(file)) {
+                if(f->needsSize()) {
                     return true;
                 }
             }
@@ -130,25 +267,638 @@ class AndFilter : public Filter {
         }
  };
  
+ // Query planner: compiles a Filter tree into a flat branch program. Nested
+ // And/Or are flattened, constants folded, duplicate predicates merged and
+ // contradictions (a directory with an extension, two types) folded away.
+ // Children are then reordered so cheap, selective checks run first. Each
+ // instruction jumps to the next one on true or false, so evaluation is a
+ // loop over a small array with no virtual calls for the built-in filters.
+ class CompiledFilter : public Filter {
+    public:
+        enum Op { OP_NAME, OP_EXT, OP_SIZE_GT, OP_TYPE, OP_CALL };
+        static const int ACCEPT = -1;
+        static const int REJECT = -2;
+        
+        struct Instr {
+            Op op;
+            string text;                // name or extension
+            size_t number;              // size bound
+            bool directory;             // wanted type
+            shared_ptr<Filter> call;    // a filter the planner does not know
+            int onTrue;                 // next instruction, or ACCEPT / REJECT
+            int onFalse;
+            bool readsSize;             // looks at FileInfo::size
+        };
+    private:
+        enum Kind { K_AND, K_OR, K_TRUE, K_FALSE, K_LEAF };
+        
+        struct Node {
+            Kind kind;
+            Instr leaf;                 // for K_LEAF, jumps unset
+            vector<Node> children;
+            double cost;                // expected work to evaluate
+            double pass;                // estimated fraction of files matching
+        };
+        
+        shared_ptr<Filter> source;      // kept so a crawler can re-plan with its own costs
+        vector<Instr> program;
+        int entry;
+        
+        static Node constant(bool value) {
+            return {value ? K_TRUE : K_FALSE, {}, {}, 0, value ? 1.0 : 0.0};
+        }
+        
+        // `sizeCost` is the extra price of a check that reads the size
+        static Node leaf(Op op, string text, size_t number, bool directory, shared_ptr<Filter> call, double sizeCost) {
+            // Rough per-file cost and selectivity; string compares cost more than scalar checks
+            static const double COST[] = {4, 3, 1, 1, 20};
+            static const double PASS[] = {0.01, 0.1, 0.5, 0.5, 0.5};
+            bool readsSize = op == OP_SIZE_GT || (call && call->needsSize());
+            return {K_LEAF, {op, text, number, directory, call, 0, 0, readsSize}, {},
+                    COST[op] + (readsSize ? sizeCost : 0), PASS[op]};
+        }
+        
+        static Node lift(const shared_ptr<Filter> &f, double sizeCost) {
+            Filter* p = f.get();
+            if(auto a = dynamic_cast<AndFilter*>(p)) {
+                Node n = {K_AND, {}, {}, 0, 1};
+                for(auto &c: a->getFilters()) {
+                    n.children.push_back(lift(c, sizeCost));
+                }
+                return n;
+            }
+            if(auto o = dynamic_cast<OrFilter*>(p)) {
+                Node n = {K_OR, {}, {}, 0, 0};
+                for(auto &c: o->getFilters()) {
+                    n.children.push_back(lift(c, sizeCost));
+                }
+                return n;
+            }
+            if(auto c = dynamic_cast<CompiledFilter*>(p)) {
+                return lift(c->source, sizeCost);
+            }
+            if(auto n = dynamic_cast<NameFilter*>(p)) {
+                return leaf(OP_NAME, n->getName(), 0, false, nullptr, sizeCost);
+            }
+            if(auto e = dynamic_cast<ExtensionFilter*>(p)) {
+                return leaf(OP_EXT, e->getExtension(), 0, false, nullptr, sizeCost);
+            }
+            if(auto s = dynamic_cast<SizeGreaterFilter*>(p)) {
+                return leaf(OP_SIZE_GT, "", s->getMinSize(), false, nullptr, sizeCost);
+            }
+            if(auto t = dynamic_cast<TypeFilter*>(p)) {
+                return leaf(OP_TYPE, "", 0, t->isDirectory(), nullptr, sizeCost);
+            }
+            return leaf(OP_CALL, "", 0, false, f, sizeCost);
+        }
+        
+        static bool same(const Node &a, const Node &b) {
+            if(a.kind != b.kind || a.children.size() != b.children.size()) {
+                return false;
+            }
+            if(a.kind == K_LEAF) {
+                const Instr &x = a.leaf, &y = b.leaf;
+                return x.op == y.op && x.text == y.text && x.number == y.number
+                    && x.directory == y.directory && x.call == y.call;
+            }
+            for(size_t i = 0; i < a.children.size(); i++) {
+                if(!same(a.children[i], b.children[i])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        
+        static Node* findLeaf(vector<Node> &nodes, Op op) {
+            for(auto &n: nodes) {
+                if(n.kind == K_LEAF && n.leaf.op == op) {
+                    return &n;
+                }
+            }
+            return nullptr;
+        }
+        
+        static void simplify(Node &n) {
+            if(n.kind != K_AND && n.kind != K_OR) {
+                return;
+            }
+            bool isAnd = n.kind == K_AND;
+            Kind absorbing = isAnd ? K_FALSE : K_TRUE;
+            Kind identity = isAnd ? K_TRUE : K_FALSE;
+            
+            vector<Node> pending = move(n.children);
+            vector<Node> kept;
+            for(size_t i = 0; i < pending.size(); i++) {
+                Node c = move(pending[i]);
+                simplify(c);
+                if(c.kind == n.kind) {      // (a AND (b AND c)) -> (a AND b AND c)
+                    for(auto &g: c.children) {
+                        kept.push_back(move(g));
+                    }
+                    continue;
+                }
+                if(c.kind == absorbing) {
+                    n = constant(!isAnd);
+                    return;
+                }
+                if(c.kind == identity) {
+                    continue;
+                }
+                kept.push_back(move(c));
+            }
+            
+            // Merge duplicates; AND keeps the tighter size bound, OR the looser
+            vector<Node> unique;
+            for(auto &c: kept) {
+                Node* size = c.kind == K_LEAF && c.leaf.op == OP_SIZE_GT ? findLeaf(unique, OP_SIZE_GT) : nullptr;
+                if(size) {
+                    size->leaf.number = isAnd ? max(size->leaf.number, c.leaf.number)
+                                              : min(size->leaf.number, c.leaf.number);
+                    continue;
+                }
+                bool seen = false;
+                for(auto &u: unique) {
+                    seen = seen || same(u, c);
+                }
+                if(!seen) {
+                    unique.push_back(move(c));
+                }
+            }
+            
+            // Type contradictions; an extension only ever matches files
+            vector<Node> typed;
+            bool wantDir = false, wantFile = false;
+            for(auto &c: unique) {
+                if(c.kind == K_LEAF && c.leaf.op == OP_TYPE) {
+                    (c.leaf.directory ? wantDir : wantFile) = true;
+                }
+            }
+            bool hasExt = findLeaf(unique, OP_EXT) != nullptr;
+            if(isAnd && ((wantDir && wantFile) || (wantDir && hasExt))) {
+                n = constant(false);
+                return;
+            }
+            if(!isAnd && wantDir && wantFile) {
+                n = constant(true);
+                return;
+            }
+            for(auto &c: unique) {
+                bool impliedFile = isAnd && hasExt && c.kind == K_LEAF && c.leaf.op == OP_TYPE && !c.leaf.directory;
+                if(!impliedFile) {
+                    typed.push_back(move(c));
+                }
+            }
+            
+            if(typed.empty()) {
+                n = constant(isAnd);
+                return;
+            }
+            if(typed.size() == 1) {
+                n = move(typed[0]);
+                return;
+            }
+            
+            // Cheapest work per decided file first
+            stable_sort(typed.begin(), typed.end(), [isAnd](const Node &a, const Node &b) {
+                double ra = a.cost / max(isAnd ? 1 - a.pass : a.pass, 1e-9);
+                double rb = b.cost / max(isAnd ? 1 - b.pass : b.pass, 1e-9);
+                return ra < rb;
+            });
+            double undecided = 1;
+            n.cost = 0;
+            for(auto &c: typed) {
+                n.cost += undecided * c.cost;
+                undecided *= isAnd ? c.pass : 1 - c.pass;
+            }
+            n.pass = isAnd ? undecided : 1 - undecided;
+            n.children = move(typed);
+        }
+        
+        // Emit `n` so it continues at onTrue/onFalse; returns its first instruction
+        int emit(const Node &n, int onTrue, int onFalse) {
+            switch(n.kind) {
+                case K_TRUE:
+                    return onTrue;
+                case K_FALSE:
+                    return onFalse;
+                case K_LEAF:
+                    program.push_back(n.leaf);
+                    program.back().onTrue = onTrue;
+                    program.back().onFalse = onFalse;
+                    return program.size() - 1;
+                default: {
+                    int next = n.kind == K_AND ? onTrue : onFalse;
+                    for(auto it = n.children.rbegin(); it != n.children.rend(); it++) {
+                        next = n.kind == K_AND ? emit(*it, next, onFalse) : emit(*it, onTrue, next);
+                    }
+                    return next;
+                }
+            }
+        }
+    public:
+        // `sizeCost` prices fetching a size on top of checking it; a crawler that
+        // has to stat for sizes passes a high one so size checks run last
+        CompiledFilter(shared_ptr<Filter> filter, double sizeCost = 0) : source(filter) {
+            Node root = lift(filter, sizeCost);
+            simplify(root);
+            entry = emit(root, ACCEPT, REJECT);
+        }
+        
+        bool matches(const FileInfo &file) {
+            FileInfo copy = file;
+            return matches(copy, true, [](FileInfo &) {});
+        }
+        
+        // Evaluate with the size filled in by `loadSize(file)` only once an
+        // instruction reads it, so files decided earlier never pay for it
+        template<class LoadSize>
+        bool matches(FileInfo &file, bool sized, LoadSize &&loadSize) {
+            int pc = entry;
+            while(pc >= 0) {
+                const Instr &in = program[pc];
+                if(in.readsSize && !sized) {
+                    loadSize(file);
+                    sized = true;
+                }
+                bool result;
+                switch(in.op) {
+                    case OP_NAME:
+                        result = file.name == in.text;
+                        break;
+                    case OP_EXT:
+                        result = !file.directory && file.name.size() >= in.text.size()
+                              && file.name.substr(file.name.size() - in.text.size()) == in.text;
+                        break;
+                    case OP_SIZE_GT:
+                        result = file.size > in.number;
+                        break;
+                    case OP_TYPE:
+                        result = file.directory == in.directory;
+                        break;
+                    default:
+                        result = in.call->matches(file);
+                }
+                pc = result ? in.onTrue : in.onFalse;
+            }
+            return pc == ACCEPT;
+        }
+        
+        // Only what survived planning counts, so a folded-away size check avoids stat
+        bool needsSize() {
+            for(auto &in: program) {
+                if(in.readsSize) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        
+        const vector<Instr>& getProgram() {
+            return program;
+        }
+ };
+ 
  class Finder {
     public:
+        // Called for each match as it is found; return false to stop the search
+        using Visitor = function<bool(const shared_ptr<File>&)>;
+        
         vector<shared_ptr<File>> find(
             shared_ptr<File> root, shared_ptr<Filter> filter) {
                 vector<shared_ptr<File>> result;
-                dfs(root, filter, result);
+                findEach(root, filter, [&](const shared_ptr<File> &file) {
+                    result.push_back(file);
+                    return true;
+                });
                 return result;
             }
+        
+        // Stream matches to `visit` without collecting them. Stops after
+        // `limit` matches (0 = no limit) or when `visit` returns false.
+        // Returns the number of matches visited.
+        size_t findEach(shared_ptr<File> root, shared_ptr<Filter> filter, Visitor visit, size_t limit = 0) {
+            size_t remaining = limit ? limit : SIZE_MAX;
+            dfs(root, *filter, visit, remaining);
+            return (limit ? limit : SIZE_MAX) - remaining;
+        }
+        
+        // Indices of matching nodes, in DFS order
+        vector<int> find(const ColumnarTree &tree, shared_ptr<Filter> filter) {
+            vector<int> result;
+            for(int i = 0; i < tree.size(); i++) {
+                if(filter->matches(tree.info(i))) {
+                    result.push_back(i);
+                }
+            }
+            return result;
+        }
     private:
-        void dfs(shared_ptr<File> node, shared_ptr<Filter> filter, vector<shared_ptr<File>> &result) {
-            if(filter->apply(node)) {
-                result.push_back(node);
+        // Nodes and the filter are borrowed, so visiting a node copies no
+        // shared_ptr. Returns false once the search should stop.
+        bool dfs(const shared_ptr<File> &node, Filter &filter, const Visitor &visit, size_t &remaining) {
+            if(filter.matches(node->info())) {
+                remaining--;
+                if(!visit(node) || remaining == 0) {
+                    return false;
+                }
             }
             
             if(node->isDirectory()) {
                 for(auto &child: node->getChildren()) {
-                    dfs(child, filter, result);
+                    if(!dfs(child, filter, visit, remaining)) {
+                        return false;
+                    }
                 }
             }
+            return true;
+        }
+ };
+ 
+ // Splits the tree at directory boundaries across threads. Each thread works
+ // LIFO on its own deque of directories and steals the oldest (usually the
+ // largest) directory from another thread when it runs dry. Filters must be
+ // safe to call from several threads; the built-in ones are.
+ class ParallelFinder {
+    private:
+        struct Worker {
+            mutex lock;
+            deque<const shared_ptr<File>*> work;    // directories still to expand
+            vector<shared_ptr<File>> results;
+        };
+        
+        // Shared by all workers of one find(); idle workers sleep on `wake`
+        struct Progress {
+            atomic<size_t> pending{1};      // directories queued or being expanded; done at 0
+            atomic<size_t> queued{1};       // directories sitting in some deque
+            mutex sleepLock;
+            condition_variable wake;
+        };
+        
+        size_t threadCount;
+        
+        const shared_ptr<File>* take(vector<Worker> &workers, size_t id, Progress &progress) {
+            Worker &self = workers[id];
+            {
+                lock_guard<mutex> guard(self.lock);
+                if(!self.work.empty()) {
+                    const shared_ptr<File>* item = self.work.back();
+                    self.work.pop_back();
+                    progress.queued--;
+                    return item;
+                }
+            }
+            for(size_t k = 1; k < workers.size(); k++) {
+                Worker &victim = workers[(id + k) % workers.size()];
+                lock_guard<mutex> guard(victim.lock);
+                if(!victim.work.empty()) {
+                    const shared_ptr<File>* item = victim.work.front();
+                    victim.work.pop_front();
+                    progress.queued--;
+                    return item;
+                }
+            }
+            return nullptr;
+        }
+        
+        void run(vector<Worker> &workers, size_t id, Filter &filter, Progress &progress) {
+            Worker &self = workers[id];
+            while(true) {
+                const shared_ptr<File>* item = take(workers, id, progress);
+                if(item == nullptr) {
+                    unique_lock<mutex> sleep(progress.sleepLock);
+                    progress.wake.wait(sleep, [&] { return progress.pending == 0 || progress.queued > 0; });
+                    if(progress.pending == 0) {
+                        return;
+                    }
+                    continue;
+                }
+                
+                const shared_ptr<File> &dir = *item;
+                if(filter.matches(dir->info())) {
+                    self.results.push_back(dir);
+                }
+                
+                const vector<shared_ptr<File>> &children = dir->getChildren();
+                size_t queued = 0;
+                {
+                    lock_guard<mutex> guard(self.lock);
+                    for(auto &child: children) {
+                        if(child->isDirectory()) {
+                            self.work.push_back(&child);
+                            queued++;
+                        }
+                    }
+                    progress.pending += queued;     // before any of them can be stolen and finished
+                    progress.queued += queued;
+                }
+                if(queued > 0) {
+                    lock_guard<mutex> sleep(progress.sleepLock);
+                    progress.wake.notify_all();
+                }
+                for(auto &child: children) {
+                    if(!child->isDirectory() && filter.matches(child->info())) {
+                        self.results.push_back(child);
+                    }
+                }
+                if(--progress.pending == 0) {
+                    lock_guard<mutex> sleep(progress.sleepLock);
+                    progress.wake.notify_all();
+                }
+            }
+        }
+    public:
+        ParallelFinder(size_t threads = 0) {
+            threadCount = threads ? threads : max(1u, thread::hardware_concurrency());
+        }
+        
+        // Same matches as Finder::find, in no particular order
+        vector<shared_ptr<File>> find(shared_ptr<File> root, shared_ptr<Filter> filter) {
+            vector<shared_ptr<File>> result;
+            if(!root->isDirectory()) {
+                if(filter->matches(root->info())) {
+                    result.push_back(root);
+                }
+                return result;
+            }
+            
+            vector<Worker> workers(threadCount);
+            Progress progress;
+            workers[0].work.push_back(&root);
+            
+            vector<thread> threads;
+            for(size_t i = 1; i < threadCount; i++) {
+                threads.emplace_back(&ParallelFinder::run, this, ref(workers), i, ref(*filter), ref(progress));
+            }
+            run(workers, 0, *filter, progress);
+            for(auto &t: threads) {
+                t.join();
+            }
+            
+            size_t total = 0;
+            for(auto &w: workers) {
+                total += w.results.size();
+            }
+            result.reserve(total);
+            for(auto &w: workers) {
+                move(w.results.begin(), w.results.end(), back_inserter(result));
+            }
+            return result;
+        }
+ };
+ 
+ // Finds files in a real Linux directory tree. Directories are opened relative
+ // to their parent's fd and listed with large getdents64 reads; the entry type
+ // comes from d_type, and statx is only called for entries whose size the
+ // filter actually reads (or when the filesystem does not fill in d_type).
+ // Symlinks are not followed.
+ class DirectoryCrawler {
+    public:
+        // Gets the full path and metadata of each entry; return false to stop
+        using PathVisitor = function<bool(const string&, const FileInfo&)>;
+    private:
+        // Also gets where to statx the entry: `statName` relative to `dirFd`
+        using EntryVisitor = function<bool(const string&, FileInfo&, int dirFd, const char* statName)>;
+        
+        // Planner cost of one statx, against a few units for an in-memory check
+        static constexpr double STAT_COST = 1000;
+        
+        vector<char> buffer;    // getdents64 output, reused by every directory
+        
+        static bool stat(int dirFd, const char* name, bool needSize, FileInfo &info) {
+            struct statx st;
+            unsigned mask = STATX_TYPE | (needSize ? STATX_SIZE : 0);
+            if(statx(dirFd, name, AT_SYMLINK_NOFOLLOW, mask, &st) != 0) {
+                return false;
+            }
+            info.size = st.stx_size;
+            info.directory = S_ISDIR(st.stx_mode);
+            return true;
+        }
+        
+        // Visit every entry of the open directory, then recurse into its
+        // subdirectories, so only one buffer and one fd per level are in use
+        bool walk(int dirFd, string &path, bool needSize, const EntryVisitor &visit) {
+            vector<string> subdirs;
+            long n;
+            while((n = syscall(SYS_getdents64, dirFd, buffer.data(), buffer.size())) > 0) {
+                for(long off = 0; off < n; ) {
+                    struct dirent64* d = (struct dirent64*)(buffer.data() + off);
+                    off += d->d_reclen;
+                    const char* name = d->d_name;
+                    if(name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) {
+                        continue;
+                    }
+                    
+                    FileInfo info = {name, 0, d->d_type == DT_DIR};
+                    if(needSize || d->d_type == DT_UNKNOWN) {
+                        stat(dirFd, name, needSize, info);
+                    }
+                    
+                    size_t base = path.size();
+                    path += '/';
+                    path += name;
+                    bool more = visit(path, info, dirFd, name);
+                    path.resize(base);
+                    if(!more) {
+                        return false;
+                    }
+                    if(info.directory) {
+                        subdirs.push_back(name);
+                    }
+                }
+            }
+            
+            for(auto &name: subdirs) {
+                size_t base = path.size();
+                path += '/';
+                path += name;
+                int fd = openat(dirFd, name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                bool more = true;
+                if(fd < 0) {
+                    cerr<<"Cannot open "<<path<<"\n";
+                } else {
+                    more = walk(fd, path, needSize, visit);
+                    close(fd);
+                }
+                path.resize(base);
+                if(!more) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        
+        // Visit `root` itself, then everything below it
+        void walkTree(const string &root, bool needSize, const EntryVisitor &visit) {
+            string path = root;
+            while(path.size() > 1 && path.back() == '/') {
+                path.pop_back();
+            }
+            string_view name = path;
+            if(path.size() > 1 && path.rfind('/') != string::npos) {
+                name = name.substr(path.rfind('/') + 1);
+            }
+            
+            FileInfo info = {name, 0, false};
+            if(!stat(AT_FDCWD, path.c_str(), needSize, info)) {
+                cerr<<"Cannot stat "<<path<<"\n";
+                return;
+            }
+            if(!visit(path, info, AT_FDCWD, path.c_str()) || !info.directory) {
+                return;
+            }
+            
+            int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if(fd < 0) {
+                cerr<<"Cannot open "<<path<<"\n";
+                return;
+            }
+            if(path == "/") {
+                path.clear();       // children become "/name", not "//name"
+            }
+            walk(fd, path, needSize, visit);
+            close(fd);
+        }
+    public:
+        DirectoryCrawler(size_t bufferSize = 1 << 18) : buffer(bufferSize) {}
+        
+        // Stream matches under `root` as they are found. Stops after `limit`
+        // matches (0 = no limit) or when `visit` returns false. Returns the
+        // number of matches visited.
+        size_t crawl(const string &root, shared_ptr<Filter> filter, PathVisitor visit, size_t limit = 0) {
+            CompiledFilter plan(filter, STAT_COST);
+            size_t count = 0;
+            walkTree(root, false, [&](const string &path, FileInfo &info, int dirFd, const char* statName) {
+                bool match = plan.matches(info, false, [&](FileInfo &f) {
+                    stat(dirFd, statName, true, f);
+                });
+                if(!match) {
+                    return true;
+                }
+                count++;
+                return visit(path, info) && count != limit;
+            });
+            return count;
+        }
+        
+        // Build an in-memory File tree of `root`, for repeated queries with Finder
+        shared_ptr<File> load(const string &root, bool withSizes = true) {
+            shared_ptr<File> top;
+            unordered_map<string, shared_ptr<File>> dirs;
+            walkTree(root, withSizes, [&](const string &path, FileInfo &info, int, const char*) {
+                auto file = make_shared<File>(string(info.name), info.size, info.directory);
+                if(!top) {
+                    top = file;
+                    dirs[path == "/" ? "" : path] = file;
+                    return true;
+                }
+                dirs[path.substr(0, path.rfind('/'))]->addChild(file);
+                if(info.directory) {
+                    dirs[path] = file;
+                }
+                return true;
+            });
+            return top;
         }
  };
  
@@ -181,11 +931,32 @@ class AndFilter : public Filter {
      auto andFilter = make_shared<AndFilter>(filters);
      
      Finder finder;
-     auto results = finder.find(root, andFilter);
+     auto results = finder.find(root, make_shared<CompiledFilter>(andFilter));
      
      cout<<"Matching Files : \n";
      for(auto &file: results) {
          cout<<file->getName()<<" (Size : "<<file->getSize()<< ")\n";
      }
+     
+     cout<<"First match only : ";
+     finder.findEach(root, andFilter, [](const shared_ptr<File> &file) {
+         cout<<file->getName()<<"\n";
+         return true;
+     }, 1);
+     
+     ParallelFinder parallelFinder(4);
+     cout<<"Parallel matches : "<<parallelFinder.find(root, andFilter).size()<<"\n";
+     
+     DirectoryCrawler crawler;
+     size_t sources = crawler.crawl(".", make_shared<ExtensionFilter>(".cpp"), [](const string &, const FileInfo &) {
+         return true;
+     });
+     cout<<".cpp files under the current directory : "<<sources<<"\n";
+     
+     ColumnarTree tree(root);
+     cout<<"Matching Files (columnar) : \n";
+     for(int i: finder.find(tree, andFilter)) {
+         cout<<tree.getName(i)<<" (Size : "<<tree.getSize(i)<< ")\n";
+     }
      return 0;
  }